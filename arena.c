@@ -0,0 +1,115 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Function to allocate memory from an arena. Memory comes from the newest
+ * chunk; when that is full a chunk at least twice as large is added, so a
+ * command line needs only a handful of malloc() calls no matter how many
+ * tokens it has.
+ *
+ * Parameters:
+ * - a: arena to allocate from
+ * - size: number of bytes needed
+ *
+ * Returns: pointer to the memory, or NULL if it cannot be allocated.
+ */
+void *arena_alloc(struct arena *a, size_t size) {
+	struct arena_chunk *chunk = a->head;
+
+	/* Round up so every allocation stays suitably aligned */
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_sz = chunk == NULL ? ARENA_CHUNK_SZ : chunk->size * 2;
+		while (chunk_sz < size) {
+			chunk_sz *= 2;
+		}
+
+		chunk = malloc(sizeof(struct arena_chunk) + chunk_sz);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->next = a->head;
+		chunk->size = chunk_sz;
+		chunk->used = 0;
+		a->head = chunk;
+	}
+
+	void *ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+/**
+ * Function to copy a string into an arena
+ *
+ * Parameters:
+ * - a: arena to allocate from
+ * - str: string to copy
+ *
+ * Returns: the copy, or NULL if it cannot be allocated.
+ */
+char *arena_strdup(struct arena *a, const char *str) {
+	return arena_strndup(a, str, strlen(str));
+}
+
+/**
+ * Function to copy the first len characters of a string into an arena
+ *
+ * Parameters:
+ * - a: arena to allocate from
+ * - str: string to copy
+ * - len: number of characters to copy
+ *
+ * Returns: the NUL terminated copy, or NULL if it cannot be allocated.
+ */
+char *arena_strndup(struct arena *a, const char *str, size_t len) {
+	char *copy = arena_alloc(a, len + 1);
+	if (copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+/**
+ * Function to release every allocation in an arena at once. The newest (and
+ * largest) chunk is kept for reuse, so a session whose lines fit in it does
+ * not call malloc() again.
+ *
+ * Parameters:
+ * - a: arena to reset
+ *
+ * Returns: void
+ */
+void arena_reset(struct arena *a) {
+	if (a->head == NULL) {
+		return;
+	}
+
+	struct arena_chunk *chunk = a->head->next;
+	while (chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	a->head->next = NULL;
+	a->head->used = 0;
+}
+
+/**
+ * Function to give all of an arena's memory back to the system
+ *
+ * Parameters:
+ * - a: arena to free
+ *
+ * Returns: void
+ */
+void arena_free(struct arena *a) {
+	arena_reset(a);
+	free(a->head);
+	a->head = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/* Preprocessor Directives */
+#define ARENA_CHUNK_SZ 4096
+#define ARENA_ALIGN 16
+
+/* Block of memory that allocations are carved out of. The header is padded
+ * so data starts ARENA_ALIGN-aligned, as malloc() returns chunks that are. */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	_Alignas(ARENA_ALIGN) char data[];
+};
+
+/* Bump allocator whose allocations are all released together */
+struct arena {
+	struct arena_chunk *head;
+};
+
+/* Function Prototypes */
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *str);
+char *arena_strndup(struct arena *a, const char *str, size_t len);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+#endif
@@ -0,0 +1,109 @@
+#!/usr/bin/env bash
+#
+# macro.sh
+#
+# Runs the same workloads under crash and a reference shell (/bin/sh by
+# default) and reports commands/sec, total CPU time and peak RSS for each.
+# Scripts are fed on stdin, the way the job runners run them; each line
+# counts as one command.
+#
+# Workloads:
+#   tiny       many small builtin and external commands
+#   pipelines  16-stage pipelines
+#   expansion  lines expanding a 64 KiB variable
+#   history    recalling earlier commands; the reference shell has no
+#              history, so it runs the recalled commands directly
+#   background many background jobs, then wait
+#
+# CPU time includes every command the shell ran. Peak RSS is the largest
+# of the shell and its commands, as wait4() reports it.
+#
+# Usage: ./bench/macro.sh [num_commands] [reference_shell]
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+crash="${bench_dir}/../crash"
+rusage="${bench_dir}/rusage"
+count=${1:-2000}
+ref_sh=${2:-/bin/sh}
+
+script=$(mktemp)
+trap 'rm -f "${script}"' EXIT
+
+# Expanded by the expansion workload
+BIG=$(head -c 65536 /dev/zero | tr '\0' x)
+export BIG
+
+# Write a workload to ${script}; the history one differs per shell
+gen() {
+    local workload=$1 shell=$2 i stage
+    case ${workload} in
+    tiny)
+        for ((i = 0; i < count; i += 4)); do
+            echo "true"
+            echo "echo tiny ${i}"
+            echo "/bin/true"
+            echo "test -n ${i}"
+        done
+        ;;
+    pipelines)
+        stage="echo line"
+        for ((i = 1; i < 16; i++)); do
+            stage+=" | cat"
+        done
+        for ((i = 0; i < count; i += 16)); do
+            echo "${stage}"
+        done
+        ;;
+    expansion)
+        for ((i = 0; i < count; i++)); do
+            echo "echo \$BIG\$HOME\$BIG > /dev/null"
+        done
+        ;;
+    history)
+        for ((i = 0; i < count; i += 4)); do
+            echo "echo recall ${i}"
+            if [[ ${shell} == "${crash}" ]]; then
+                echo "!!"
+                echo "!echo"
+                echo "!!"
+            else
+                echo "echo recall ${i}"
+                echo "echo recall ${i}"
+                echo "echo recall ${i}"
+            fi
+        done
+        ;;
+    background)
+        for ((i = 0; i < count; i += 64)); do
+            for ((stage = 0; stage < 63; stage++)); do
+                echo "/bin/true &"
+            done
+            echo "wait"
+        done
+        ;;
+    esac > "${script}"
+}
+
+# Run the workload in ${script} under a shell and print a row
+run() {
+    local workload=$1 shell=$2 lines result
+    lines=$(wc -l < "${script}")
+    result=$("${rusage}" "${shell}" < "${script}") || return
+    read -r wall user sys maxrss status <<< "${result}"
+    awk -v w="${workload}" -v s="$(basename "${shell}")" -v n="${lines}" -v wall="${wall}" \
+        -v cpu=$((user + sys)) -v rss="${maxrss}" -v st="${status}" \
+        'BEGIN { printf "%-11s %-6s %10.0f %9.3f %8d %6d\n", w, s, n / (wall / 1e9), cpu / 1e9, rss, st }'
+}
+
+if [[ ! -x ${rusage} ]]; then
+    echo "macro.sh: ${rusage} not built; run make bench/rusage" >&2
+    exit 1
+fi
+
+printf "%-11s %-6s %10s %9s %8s %6s\n" workload shell cmds/sec cpu_s rss_kb status
+for workload in tiny pipelines expansion history background; do
+    for shell in "${crash}" "${ref_sh}"; do
+        gen "${workload}" "${shell}"
+        run "${workload}" "${shell}"
+    done
+done
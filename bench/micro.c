@@ -0,0 +1,193 @@
+/**
+ * micro.c
+ *
+ * Microbenchmarks of the shell's hot paths: lexing, variable expansion,
+ * history and running pipelines of 1 to 16 external commands. Results are
+ * printed as JSON, one object per benchmark with the time and the number of
+ * heap allocations per operation, so runs of two revisions can be compared.
+ *
+ * Usage: ./bench/micro [min_ms]
+ *
+ * Each benchmark runs for at least min_ms milliseconds (default 200).
+ */
+
+#include "../exec.h"
+#include "../history.h"
+#include "../jobs.h"
+#include "../shell.h"
+#include "../tokenizer.h"
+
+/* Preprocessor Directives */
+#define BENCH_MIN_MS 200
+#define BENCH_MAX_DEPTH 16
+#define BENCH_LINE_SZ 512
+
+/* Provided by glibc; the wrappers below count calls and pass them on */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+/* Heap allocations made by any thread so far */
+static unsigned long long allocs;
+
+void *malloc(size_t size) {
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+/* Struct to store a benchmark: op runs one operation, i being its number */
+struct bench {
+	const char *name;
+	void (*op)(unsigned long long i);
+};
+
+/* Line lexed and expanded by the benchmarks, and the pipeline to execute */
+static const char *bench_line = "grep -n \"$HOME\" notes.txt | sort -r > 'out file' && echo $USER:$? done";
+static const char *bench_word = "$HOME/src/${USER}-$?.log";
+static char pipeline_line[BENCH_LINE_SZ];
+
+/**
+ * Function to lex one command line
+ */
+static void bench_lex_line(unsigned long long i) {
+	struct token_list toks;
+	lex_line(&line_arena, bench_line, &toks);
+	arena_reset(&line_arena);
+}
+
+/**
+ * Function to expand the variables of one word
+ */
+static void bench_expand_var(unsigned long long i) {
+	expand_var(&line_arena, bench_word, strlen(bench_word));
+	arena_reset(&line_arena);
+}
+
+/**
+ * Function to add a line to a full history, which evicts the oldest one
+ */
+static void bench_add_history(unsigned long long i) {
+	char line[64];
+	snprintf(line, sizeof(line), "make -j%llu bench\n", i % 64);
+	if (add_history(cmd_id, strdup(line))) {
+		cmd_id++;
+	}
+}
+
+/**
+ * Function to look up a history entry by its cmd id
+ */
+static void bench_get_entry(unsigned long long i) {
+	struct history_entry entry;
+	get_entry(cmd_id - 1 - (int)(i % HIST_MAX), &entry);
+}
+
+/**
+ * Function to look up the newest history entry starting with a prefix
+ */
+static void bench_get_entry_by_line(unsigned long long i) {
+	static const char *prefixes[] = { "make -j1", "make -j63", "make", "git" };
+	struct history_entry entry;
+	get_entry_by_line(prefixes[i % 4], cmd_id - 1, &entry);
+}
+
+/**
+ * Function to run the pipeline in pipeline_line
+ */
+static void bench_execute(unsigned long long i) {
+	execute(pipeline_line);
+	arena_reset(&line_arena);
+}
+
+/**
+ * Function to run a benchmark for at least min_ns and print its result.
+ * The number of operations doubles until a run takes long enough.
+ *
+ * Parameters:
+ * - b: benchmark to run
+ * - min_ns: shortest run to report
+ * - first: true for the first result printed
+ *
+ * Returns: void
+ */
+static void run_bench(const struct bench *b, long long min_ns, bool first) {
+	unsigned long long n = 1, i, start_allocs;
+	long long start, elapsed;
+
+	/* Warm up caches and lazily built state */
+	b->op(0);
+
+	while (true) {
+		start_allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+		start = now_ns();
+		for (i = 0; i < n; i++) {
+			b->op(i);
+		}
+		elapsed = now_ns() - start;
+		if (elapsed >= min_ns) {
+			break;
+		}
+		n *= 2;
+	}
+
+	unsigned long long ops_allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - start_allocs;
+	printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f}",
+			first ? "" : ",", b->name, n, (double)elapsed / n, (double)ops_allocs / n);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	static const struct bench benches[] = {
+		{ "lex_line", bench_lex_line },
+		{ "expand_var", bench_expand_var },
+		{ "add_history", bench_add_history },
+		{ "get_entry", bench_get_entry },
+		{ "get_entry_by_line", bench_get_entry_by_line },
+	};
+	long long min_ns = (argc > 1 ? atoll(argv[1]) : BENCH_MIN_MS) * 1000000LL;
+	char name[32];
+	size_t i;
+	int depth;
+
+	/* Set up the parts of the shell the benchmarks use, like main() does */
+	init_history();
+	signal(SIGPIPE, SIG_IGN);
+	init_jobs();
+
+	/* Fill the history so lookups and evictions run at steady state */
+	for (i = 0; i < HIST_MAX; i++) {
+		bench_add_history(i);
+	}
+
+	printf("{\n  \"benchmarks\": [");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		run_bench(&benches[i], min_ns, i == 0);
+	}
+
+	/* External commands, so every stage costs a process */
+	for (depth = 1; depth <= BENCH_MAX_DEPTH; depth++) {
+		size_t len = 0;
+		int d;
+		for (d = 0; d < depth; d++) {
+			len += snprintf(pipeline_line + len, sizeof(pipeline_line) - len,
+					d == 0 ? "/bin/true" : " | /bin/true");
+		}
+		snprintf(name, sizeof(name), "execute_depth_%d", depth);
+		struct bench b = { name, bench_execute };
+		run_bench(&b, min_ns, false);
+	}
+	printf("\n  ]\n}\n");
+
+	arena_free(&line_arena);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * rusage.c
+ *
+ * Runs a command and reports what it used, for bench/macro.sh: wall time,
+ * user and system CPU time and peak resident set size. The CPU times include
+ * the children the command waited for; the peak RSS is the largest of the
+ * command and those children. The command's stdout goes to /dev/null.
+ *
+ * Usage: ./bench/rusage command [args...]
+ *
+ * Prints one line: wall_ns user_ns sys_ns maxrss_kb exit_status
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Function to read the monotonic clock
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: current time in nanoseconds.
+ */
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Function to convert a timeval from wait4() to nanoseconds
+ */
+static long long timeval_ns(const struct timeval *tv) {
+	return tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL;
+}
+
+int main(int argc, char *argv[]) {
+	struct rusage ru;
+	int wstatus;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+		return 2;
+	}
+
+	long long start = now_ns();
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd != -1) {
+			dup2(null_fd, STDOUT_FILENO);
+			close(null_fd);
+		}
+		execvp(argv[1], argv + 1);
+		fprintf(stderr, "rusage: %s: %s\n", argv[1], strerror(errno));
+		_exit(127);
+	}
+
+	while (wait4(pid, &wstatus, 0, &ru) == -1) {
+		if (errno != EINTR) {
+			perror("wait4");
+			return 1;
+		}
+	}
+	long long wall = now_ns() - start;
+
+	printf("%lld %lld %lld %ld %d\n", wall, timeval_ns(&ru.ru_utime), timeval_ns(&ru.ru_stime),
+			ru.ru_maxrss, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus));
+	return 0;
+}
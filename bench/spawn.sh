@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+#
+# spawn.sh
+#
+# Compares how many commands per second crash can launch with the fork
+# launcher (CRASH_EXEC=fork) and the posix_spawn launcher (CRASH_EXEC=spawn).
+#
+# Usage: ./bench/spawn.sh [num_commands]
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+crash="${bench_dir}/../crash"
+count=${1:-2000}
+
+script=$(mktemp)
+trap 'rm -f "${script}"' EXIT
+
+# Run one workload under the given launcher and print commands/sec
+run() {
+    local mode=$1 label=$2
+    local start end
+    start=$(date +%s%N)
+    CRASH_EXEC=${mode} "${crash}" < "${script}" > /dev/null
+    end=$(date +%s%N)
+    awk -v n="${count}" -v ns=$((end - start)) -v m="${mode}" -v l="${label}" \
+        'BEGIN { printf "%-10s %-6s %10.0f cmds/sec\n", l, m, n / (ns / 1e9) }'
+}
+
+for workload in "true" "true | true"; do
+    yes "${workload}" | head -n "${count}" > "${script}"
+    run fork "${workload// /}"
+    run spawn "${workload// /}"
+done
@@ -0,0 +1,516 @@
+#include "builtins.h"
+#include "debug.h"
+#include "exec.h"
+#include "history.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "pathcache.h"
+#include "prompt.h"
+#include "shell.h"
+#include "stats.h"
+#include "trace.h"
+#include "utilities.h"
+
+#include <errno.h>
+
+/**
+ * Function to change the working directory, to the home directory if no
+ * directory is given
+ *
+ * Parameters:
+ * - tokens: "cd" and an optional directory
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: 0 on success, 1 if the directory cannot be entered.
+ */
+static int builtin_cd(char *tokens[], char *line, FILE *out) {
+	/* Check if second argument is given */
+	if (tokens[1] != NULL) {
+		/* If given, check if directory exists */
+		if (chdir(tokens[1]) == 0) {
+			LOG("Switched directories from %s to %s successfully\n", cwd, tokens[1]);
+		} else {
+			LOG("Could not switch directories from %s to %s\n", cwd, tokens[1]);
+			return 1;
+		}
+	/* If no second argument, switch to home directory */
+	} else {
+		/* Without a prompt, home_dir is never looked up */
+		const char *home = home_dir[0] != '\0' ? home_dir : getenv("HOME");
+		if (home == NULL || chdir(home) == -1) {
+			return 1;
+		}
+		LOG("Swtiched directories from %s to %s successfully\n", cwd, home);
+	}
+
+	/* The prompt shows the cached directory */
+	update_cwd();
+	return 0;
+}
+
+/**
+ * Function to list the history
+ *
+ * Parameters:
+ * - tokens: "history"
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0
+ */
+static int builtin_history(char *tokens[], char *line, FILE *out) {
+	print_history(out);
+	return 0;
+}
+
+/* Set while a recalled command runs */
+static bool recalling;
+
+/**
+ * Function to run a command recalled from history. A recalled command may
+ * not recall another, or a line like "echo; !!" would run itself forever.
+ *
+ * Parameters:
+ * - entry: history entry to run
+ * - name: the recalling command, for the error message
+ *
+ * Returns: exit status of the command, or 1 if it is not run.
+ */
+static int run_recalled(struct history_entry *entry, const char *name) {
+	if (recalling) {
+		fprintf(stderr, "crash: %s: recursive history recall\n", name);
+		return 1;
+	}
+	recalling = true;
+	execute(arena_strndup(&line_arena, entry->line, entry->len));
+	recalling = false;
+	return last_status;
+}
+
+/**
+ * Function to run the last command again ("!!"). The line being run may
+ * already be in the history, so the last command is the one before it.
+ *
+ * Parameters:
+ * - tokens: "!!"
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: exit status of the command, or 1 if there is none.
+ */
+static int builtin_last(char *tokens[], char *line, FILE *out) {
+	struct history_entry temp;
+	/* Check if last entry exists */
+	if (get_entry(line_id - 1, &temp)) {
+		return run_recalled(&temp, tokens[0]);
+	}
+	fprintf(stderr, "No last entry found\n");
+	return 1;
+}
+
+/**
+ * Function to run a command from history again, by cmd id ("!3") or by the
+ * beginning of its line ("!ls"). Only entries older than the line being run
+ * are looked at.
+ *
+ * Parameters:
+ * - tokens: "!" and its argument as one word
+ * - line: line starting with "!", or NULL inside a pipeline
+ * - out: unused
+ *
+ * Returns: exit status of the command, or 1 if there is none.
+ */
+static int builtin_recall(char *tokens[], char *line, FILE *out) {
+	struct history_entry temp;
+	bool found;
+
+	/* A pipeline stage has no line of its own; its first word will do */
+	if (line == NULL) {
+		line = tokens[0];
+	}
+
+	/* Get line without blanks and ! */
+	line += strspn(line, " \t");
+	line += strspn(line, "!");
+	line[strcspn(line, "!\r\n")] = '\0';
+
+	/* Check if argument is cmd id */
+	int id = atoi(line);
+	if (id > 0) {
+		found = id < line_id && get_entry(id, &temp);
+	}
+
+	/* If argument is line */
+	else {
+		found = get_entry_by_line(line, line_id - 1, &temp);
+		if (!found) {
+			fprintf(stderr, "No last entry found\n");
+		}
+	}
+
+	if (!found) {
+		return 1;
+	}
+	return run_recalled(&temp, tokens[0]);
+}
+
+/**
+ * Function to set an environment variable, and update whatever the shell
+ * caches about it
+ *
+ * Parameters:
+ * - tokens: "setenv", the variable and its value
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: 0 on success, 1 if the variable or value is missing.
+ */
+static int builtin_setenv(char *tokens[], char *line, FILE *out) {
+	/* Check if there are enough commands, then setenv */
+	if (tokens[1] == NULL || tokens[2] == NULL) {
+		fprintf(stderr, "crash: setenv: usage: setenv name value\n");
+		return 1;
+	}
+	if (setenv(tokens[1], tokens[2], true) == -1) {
+		perror("setenv");
+		return 1;
+	}
+
+	/* Commands may resolve differently on the new PATH */
+	if (strcmp(tokens[1], "PATH") == 0) {
+		path_cache_clear();
+	}
+	/* Resize history when its size changes */
+	else if (strcmp(tokens[1], HISTSIZE_VAR) == 0 && atoi(tokens[2]) > 0) {
+		set_history_size(atoi(tokens[2]));
+	}
+	/* A new prompt format is compiled once, here */
+	else if (strcmp(tokens[1], PROMPT_VAR) == 0 && interactive) {
+		compile_prompt(tokens[2]);
+	}
+	return 0;
+}
+
+/**
+ * Function to list, forget or remember where commands are found on PATH
+ *
+ * Parameters:
+ * - tokens: "hash" and either nothing, "-r", or command names
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0 on success, 1 if a command is not found.
+ */
+static int builtin_hash(char *tokens[], char *line, FILE *out) {
+	int ret = 0;
+
+	/* With no arguments, list remembered commands */
+	if (tokens[1] == NULL) {
+		print_path_cache(out);
+	/* "hash -r" forgets everything */
+	} else if (strcmp(tokens[1], "-r") == 0) {
+		path_cache_clear();
+	/* Otherwise look up and remember each name given */
+	} else {
+		int i;
+		for (i = 1; tokens[i] != NULL; i++) {
+			if (!path_cache_add(tokens[i])) {
+				fprintf(stderr, "crash: hash: %s: not found\n", tokens[i]);
+				ret = 1;
+			}
+		}
+	}
+	return ret;
+}
+
+/**
+ * Function to show how long each command took this session
+ *
+ * Parameters:
+ * - tokens: "stats" and an optional "-r" to clear the statistics
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0 on success, 2 on a usage error.
+ */
+static int builtin_stats(char *tokens[], char *line, FILE *out) {
+	if (tokens[1] == NULL) {
+		print_stats(out);
+	} else if (strcmp(tokens[1], "-r") == 0 && tokens[2] == NULL) {
+		clear_stats();
+	} else {
+		fprintf(stderr, "crash: stats: usage: stats [-r]\n");
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Function to dump the trace of recent events as Chrome trace JSON, or to
+ * clear it
+ *
+ * Parameters:
+ * - tokens: "trace" and "dump" with an optional file, or "clear"
+ * - line: unused
+ * - out: stream to dump to when no file is given
+ *
+ * Returns: 0 on success, 1 if the trace cannot be written, 2 on a usage
+ * error.
+ */
+static int builtin_trace(char *tokens[], char *line, FILE *out) {
+	int ret = 0;
+
+	if (tokens[1] != NULL && strcmp(tokens[1], "clear") == 0 && tokens[2] == NULL) {
+		trace_clear();
+	} else if (tokens[1] != NULL && strcmp(tokens[1], "dump") == 0 && tokens[2] == NULL) {
+		fflush(out);
+		ret = trace_dump(fileno(out)) == -1;
+	} else if (tokens[1] != NULL && strcmp(tokens[1], "dump") == 0 && tokens[3] == NULL) {
+		int fd = open(tokens[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd == -1 || trace_dump(fd) == -1) {
+			fprintf(stderr, "crash: trace: %s: %s\n", tokens[2], strerror(errno));
+			ret = 1;
+		}
+		if (fd != -1) {
+			close(fd);
+		}
+	} else {
+		fprintf(stderr, "crash: trace: usage: trace dump [file] | trace clear\n");
+		return 2;
+	}
+	return ret;
+}
+
+/**
+ * Function to list background jobs
+ *
+ * Parameters:
+ * - tokens: "jobs"
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0
+ */
+static int builtin_jobs(char *tokens[], char *line, FILE *out) {
+	/* Jobs that finished are left for the main loop to reap, so this can
+	 * run on a thread while the shell waits for a pipeline */
+	print_jobs(out);
+	return 0;
+}
+
+/**
+ * Function to wait for background jobs: all of them, the ones given by job
+ * number ("%1") or pid, or with "-n" whichever finishes next
+ *
+ * Parameters:
+ * - tokens: "wait" and optional "-n" or jobs
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: exit status of the last job waited for, 0 when waiting for all
+ * jobs, or 127 if a job does not exist.
+ */
+static int builtin_wait(char *tokens[], char *line, FILE *out) {
+	int i, status = 0;
+
+	/* With no arguments, wait for every job */
+	if (tokens[1] == NULL) {
+		wait_all_jobs();
+		return 0;
+	}
+	/* "wait -n" waits for whichever job finishes next */
+	if (strcmp(tokens[1], "-n") == 0) {
+		return wait_any_job();
+	}
+
+	for (i = 1; tokens[i] != NULL; i++) {
+		struct job *job = find_job_spec(tokens[i]);
+		/* A job that finished may have left the table already */
+		if (job == NULL && tokens[i][0] != '%' && reported_status(atoi(tokens[i]), &status)) {
+			continue;
+		}
+		if (job == NULL) {
+			fprintf(stderr, "crash: wait: %s: no such job\n", tokens[i]);
+			status = 127;
+		} else {
+			status = wait_job(job);
+		}
+	}
+	return status;
+}
+
+/**
+ * Function to exit the shell
+ *
+ * Parameters:
+ * - tokens: "exit"
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: does not return.
+ */
+static int builtin_exit(char *tokens[], char *line, FILE *out) {
+	exit(0);
+}
+
+/* Every builtin, looked up by builtin_lookup() */
+enum builtin_id {
+	BI_BRACKET, BI_CD, BI_ECHO, BI_EXIT, BI_FALSE, BI_HASH, BI_HISTORY,
+	BI_JOBS, BI_PARALLEL, BI_PRINTF, BI_PWD, BI_SETENV, BI_STATS, BI_TEST,
+	BI_TRACE, BI_TRUE, BI_WAIT, BI_LAST, BI_RECALL,
+};
+
+/* Builtins that change the shell or read their input (cd, wait, parallel,
+ * ...) fork in a pipeline, like in other shells: "wait | cat" has no jobs
+ * to wait for. "hash -r" and "stats -r" may clear their tables from a
+ * thread, since the shell does not use them while it waits for a pipeline.
+ * Recalling history runs a whole line in the shell, so it cannot be a
+ * pipeline stage at all. */
+static const struct builtin builtins[] = {
+	[BI_BRACKET] = { "[", builtin_bracket, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_CD] = { "cd", builtin_cd, 0 },
+	[BI_ECHO] = { "echo", builtin_echo, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_EXIT] = { "exit", builtin_exit, 0 },
+	[BI_FALSE] = { "false", builtin_false, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_HASH] = { "hash", builtin_hash, BUILTIN_OUTPUT },
+	[BI_HISTORY] = { "history", builtin_history, BUILTIN_OUTPUT },
+	[BI_JOBS] = { "jobs", builtin_jobs, BUILTIN_OUTPUT },
+	[BI_PARALLEL] = { "parallel", builtin_parallel, 0 },
+	[BI_PRINTF] = { "printf", builtin_printf, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_PWD] = { "pwd", builtin_pwd, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_SETENV] = { "setenv", builtin_setenv, 0 },
+	[BI_STATS] = { "stats", builtin_stats, BUILTIN_OUTPUT },
+	[BI_TEST] = { "test", builtin_test, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_TRACE] = { "trace", builtin_trace, BUILTIN_OUTPUT },
+	[BI_TRUE] = { "true", builtin_true, BUILTIN_UTILITY | BUILTIN_OUTPUT },
+	[BI_WAIT] = { "wait", builtin_wait, 0 },
+	[BI_LAST] = { "!!", builtin_last, BUILTIN_RECALL },
+	[BI_RECALL] = { "!", builtin_recall, BUILTIN_RECALL },
+};
+
+/**
+ * Function to find the builtin with a name. Names are told apart by their
+ * length and first characters, so a command that is not a builtin costs one
+ * switch and at most one string compare. To add a builtin, write its handler,
+ * add it to builtins[] and add its name under the case for its length.
+ *
+ * Parameters:
+ * - name: command name
+ *
+ * Returns: the builtin, or NULL if name is not a builtin.
+ */
+const struct builtin *builtin_lookup(const char *name) {
+	const struct builtin *b;
+
+	/* "!!" and "!..." recall history */
+	if (name[0] == '!') {
+		return &builtins[strcmp(name, "!!") == 0 ? BI_LAST : BI_RECALL];
+	}
+
+	switch (strlen(name)) {
+	case 1:
+		b = &builtins[BI_BRACKET];
+		break;
+	case 2:
+		b = &builtins[BI_CD];
+		break;
+	case 3:
+		b = &builtins[BI_PWD];
+		break;
+	case 4:
+		switch (name[0]) {
+		case 'e':
+			b = &builtins[name[1] == 'c' ? BI_ECHO : BI_EXIT];
+			break;
+		case 'h':
+			b = &builtins[BI_HASH];
+			break;
+		case 'j':
+			b = &builtins[BI_JOBS];
+			break;
+		case 't':
+			b = &builtins[name[1] == 'r' ? BI_TRUE : BI_TEST];
+			break;
+		case 'w':
+			b = &builtins[BI_WAIT];
+			break;
+		default:
+			return NULL;
+		}
+		break;
+	case 5:
+		switch (name[0]) {
+		case 'f':
+			b = &builtins[BI_FALSE];
+			break;
+		case 's':
+			b = &builtins[BI_STATS];
+			break;
+		default:
+			b = &builtins[BI_TRACE];
+			break;
+		}
+		break;
+	case 6:
+		b = &builtins[name[0] == 'p' ? BI_PRINTF : BI_SETENV];
+		break;
+	case 7:
+		b = &builtins[BI_HISTORY];
+		break;
+	case 8:
+		b = &builtins[BI_PARALLEL];
+		break;
+	default:
+		return NULL;
+	}
+
+	return strcmp(name, b->name) == 0 ? b : NULL;
+}
+
+/**
+ * Function to allow the shell to support built in functions that execvp() cannot
+ *
+ * Parameters:
+ * - p: pipeline of the line
+ * - line: line to add to history
+ * 			
+ * Returns: true if the line was handled by a builtin, false if it should be
+ * run as external commands.
+ */
+bool builtin_cmd(struct pipeline *p, char *line) {
+	char **tokens = p->cmds[0].tokens;
+
+	/* If no tokens, return null */
+	if (tokens[0] == NULL) {
+		return false;
+	}
+
+	const struct builtin *b = builtin_lookup(tokens[0]);
+	if (b == NULL) {
+		return false;
+	}
+
+	/* Pipelines run their builtin stages themselves. Stand-ins for
+	 * utilities only run in the shell when that saves a process;
+	 * background jobs use the real ones. */
+	if (p->num_cmds > 1 || ((b->flags & BUILTIN_UTILITY) && p->background)) {
+		return false;
+	}
+
+	int saved[3];
+	if (apply_redirects(&p->cmds[0], saved) == -1) {
+		restore_redirects(saved);
+		last_status = 1;
+		return true;
+	}
+
+	long long start = now_ns();
+	trace_event(TRACE_BUILTIN_START, 0, 0, b->name);
+	last_status = b->fn(tokens, line, stdout);
+	trace_event(TRACE_BUILTIN_END, 0, last_status, b->name);
+	record_latency(b->name, now_ns() - start);
+
+	restore_redirects(saved);
+	return true;
+}
@@ -0,0 +1,29 @@
+#ifndef _BUILTINS_H_
+#define _BUILTINS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "shell.h"
+
+/* Every builtin takes the command's tokens, the line it came from and the
+ * stream to write its output to, and returns its exit status */
+typedef int (*builtin_fn)(char *tokens[], char *line, FILE *out);
+
+/* Builtin flags */
+#define BUILTIN_UTILITY 0x1 /* Stands in for an external utility of the same name */
+#define BUILTIN_OUTPUT 0x2 /* Only reads shell state, so it can run on a thread */
+#define BUILTIN_RECALL 0x4 /* Runs a line from history, so it cannot be piped */
+
+/* Struct to describe a builtin */
+struct builtin {
+	const char *name;
+	builtin_fn fn;
+	int flags;
+};
+
+/* Function Prototypes */
+const struct builtin *builtin_lookup(const char *name);
+bool builtin_cmd(struct pipeline *p, char *line);
+
+#endif
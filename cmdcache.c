@@ -0,0 +1,352 @@
+#include "cmdcache.h"
+#include "debug.h"
+#include "exec.h"
+#include "shell.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Globals */
+struct parsed_line *cmd_cache[CMD_CACHE_SZ];
+
+/**
+ * Function to hash a line (FNV-1a)
+ *
+ * Parameters:
+ * - line: line to hash
+ * - len: length of the line
+ *
+ * Returns: hash of the line.
+ */
+static size_t hash_line(const char *line, size_t len) {
+	size_t hash = 14695981039346656037UL, i;
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)line[i];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/**
+ * Function to drop a line from the cache. A line that is still running is
+ * freed by parse_release() instead.
+ *
+ * Parameters:
+ * - pl: cached line, or NULL
+ *
+ * Returns: void
+ */
+static void evict(struct parsed_line *pl) {
+	if (pl == NULL) {
+		return;
+	}
+	pl->cached = false;
+	if (pl->users == 0) {
+		free(pl);
+	}
+}
+
+/**
+ * Function to get the kind of redirection an operator makes
+ *
+ * Parameters:
+ * - type: token type of the operator
+ * - redir: set to the kind of redirection
+ *
+ * Returns: true if the operator is a redirection, false if not.
+ */
+static bool redirect_op(enum token_type type, enum redirect_type *redir) {
+	switch (type) {
+	case TOK_LT:
+		*redir = REDIR_IN;
+		return true;
+	case TOK_GT:
+		*redir = REDIR_OUT;
+		return true;
+	case TOK_DGT:
+		*redir = REDIR_APPEND;
+		return true;
+	case TOK_ERR_GT:
+		*redir = REDIR_ERR;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Function to report a line that cannot be parsed
+ *
+ * Parameters:
+ * - tok: token the parser stopped at, or NULL at the end of the line
+ *
+ * Returns: void
+ */
+static void syntax_error(struct token *tok) {
+	fprintf(stderr, "crash: syntax error near unexpected token `%.*s'\n",
+			tok == NULL ? 7 : (int)tok->len, tok == NULL ? "newline" : tok->start);
+	last_status = 2;
+}
+
+/**
+ * Function to check whether a token ends a pipeline of a list
+ *
+ * Parameters:
+ * - type: token type
+ *
+ * Returns: true for &&, ||, ; and &.
+ */
+static bool list_op(enum token_type type) {
+	return type == TOK_AND || type == TOK_OR || type == TOK_SEMI || type == TOK_AMP;
+}
+
+/**
+ * Function to check whether a word is the time keyword: a time that starts
+ * a pipeline and is followed by a command
+ *
+ * Parameters:
+ * - toks: tokens of the line
+ * - t: index of the word
+ *
+ * Returns: true if the word is the keyword.
+ */
+static bool time_keyword(struct token_list *toks, size_t t) {
+	struct token *tok = &toks->tokens[t];
+	if (tok->type != TOK_WORD || tok->len != 4 || memcmp(tok->start, "time", 4) != 0) {
+		return false;
+	}
+	return (t == 0 || list_op(toks->tokens[t - 1].type))
+			&& t + 1 < toks->count && !list_op(toks->tokens[t + 1].type)
+			&& toks->tokens[t + 1].type != TOK_PIPE;
+}
+
+/**
+ * Function to parse a line into a list of pipelines, their stages, and the
+ * words and redirections of each stage. The tokens are lexed into the line
+ * arena, then copied with everything else into one block so the result
+ * outlives the line.
+ *
+ * Parameters:
+ * - line: line to parse
+ * - key_len: length of the line without its trailing newline
+ * - hash: hash of the line
+ *
+ * Returns: the parsed line, or NULL if it cannot be parsed.
+ */
+static struct parsed_line *build_parsed(const char *line, size_t key_len, size_t hash) {
+	struct token_list toks;
+	enum redirect_type redir;
+	size_t t, num_words = 0, num_redirs = 0, text_sz = key_len + 1;
+	int num_stages = 1, num_pipelines = 1;
+
+	trace_event(TRACE_LEX_START, 0, 0, NULL);
+	if (lex_line(&line_arena, line, &toks) == -1) {
+		perror("lex_line");
+		trace_event(TRACE_LEX_END, 0, -1, NULL);
+		return NULL;
+	}
+	trace_event(TRACE_LEX_END, 0, toks.count, NULL);
+
+	/* Size everything first; stages and pipelines are counted by their
+	 * separators, which gives an upper bound */
+	for (t = 0; t < toks.count; t++) {
+		struct token *tok = &toks.tokens[t];
+		if (tok->type == TOK_PIPE) {
+			num_stages++;
+		} else if (list_op(tok->type)) {
+			num_stages++;
+			num_pipelines++;
+		} else if (tok->type == TOK_WORD) {
+			num_words += (t == 0 || !redirect_op(toks.tokens[t - 1].type, &redir))
+					&& !time_keyword(&toks, t);
+			text_sz += tok->len + 1;
+		} else if (redirect_op(tok->type, &redir)) {
+			/* Every redirection needs a file */
+			if (t + 1 == toks.count || toks.tokens[t + 1].type != TOK_WORD) {
+				syntax_error(t + 1 == toks.count ? NULL : &toks.tokens[t + 1]);
+				return NULL;
+			}
+			num_redirs++;
+		}
+	}
+
+	struct parsed_line *pl = malloc(sizeof(struct parsed_line)
+			+ sizeof(struct parsed_pipeline) * num_pipelines
+			+ sizeof(struct parsed_stage) * num_stages
+			+ sizeof(struct parsed_redir) * num_redirs
+			+ sizeof(struct parsed_word) * num_words + text_sz);
+	if (pl == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	pl->pipelines = (struct parsed_pipeline *)(pl + 1);
+	pl->stages = (struct parsed_stage *)(pl->pipelines + num_pipelines);
+	pl->redirs = (struct parsed_redir *)(pl->stages + num_stages);
+	pl->words = (struct parsed_word *)(pl->redirs + num_redirs);
+	pl->key = (char *)(pl->words + num_words);
+	pl->hash = hash;
+	pl->key_len = key_len;
+	pl->num_words = 0;
+	pl->num_redirs = 0;
+	pl->num_stages = 0;
+	pl->num_pipelines = 0;
+	pl->users = 0;
+	pl->cached = false;
+	memcpy(pl->key, line, key_len);
+	pl->key[key_len] = '\0';
+
+	char *text = pl->key + key_len + 1;
+	struct parsed_pipeline *pipeline = NULL;
+	struct parsed_stage *stage = NULL;
+	enum list_op op = LIST_SEQ;
+
+	for (t = 0; t <= toks.count; t++) {
+		struct token *tok = t < toks.count ? &toks.tokens[t] : NULL;
+		bool empty_stage = stage == NULL || (stage->num_words == 0 && stage->num_redirs == 0);
+
+		/* The end of the line and list operators end the pipeline */
+		if (tok == NULL || list_op(tok->type)) {
+			if (empty_stage && (pipeline != NULL || tok != NULL || op != LIST_SEQ)) {
+				/* Only a ; or & list may end without a command */
+				syntax_error(tok);
+				free(pl);
+				return NULL;
+			}
+			if (pipeline != NULL) {
+				pipeline->background = tok != NULL && tok->type == TOK_AMP;
+			}
+			if (tok != NULL) {
+				op = tok->type == TOK_AND ? LIST_AND : tok->type == TOK_OR ? LIST_OR : LIST_SEQ;
+			}
+			pipeline = NULL;
+			stage = NULL;
+			continue;
+		}
+		/* Find pipe */
+		if (tok->type == TOK_PIPE) {
+			if (empty_stage) {
+				syntax_error(tok);
+				free(pl);
+				return NULL;
+			}
+			stage = NULL;
+			continue;
+		}
+
+		/* The first word or redirection starts a stage, and maybe a pipeline */
+		if (pipeline == NULL) {
+			pipeline = &pl->pipelines[pl->num_pipelines++];
+			pipeline->first_stage = pl->num_stages;
+			pipeline->num_stages = 0;
+			pipeline->op = op;
+			pipeline->background = false;
+			pipeline->timed = false;
+
+			/* An unquoted time before a command times the whole pipeline */
+			if (time_keyword(&toks, t)) {
+				pipeline->timed = true;
+				continue;
+			}
+		}
+		if (stage == NULL) {
+			stage = &pl->stages[pl->num_stages++];
+			stage->first_word = pl->num_words;
+			stage->num_words = 0;
+			stage->first_redir = pl->num_redirs;
+			stage->num_redirs = 0;
+			pipeline->num_stages++;
+		}
+		if (redirect_op(tok->type, &redir)) {
+			continue;
+		}
+
+		/* The word after a redirection names the file; it is not an argument */
+		struct parsed_word *word;
+		if (t > 0 && redirect_op(toks.tokens[t - 1].type, &redir)) {
+			pl->redirs[pl->num_redirs].type = redir;
+			word = &pl->redirs[pl->num_redirs++].path;
+			stage->num_redirs++;
+		} else {
+			word = &pl->words[pl->num_words++];
+			stage->num_words++;
+		}
+		memcpy(text, tok->start, tok->len);
+		text[tok->len] = '\0';
+		word->text = text;
+		word->len = tok->len;
+		word->flags = tok->flags;
+		text += tok->len + 1;
+	}
+	return pl;
+}
+
+/**
+ * Function to get the parsed form of a line. Lines are cached by their text,
+ * so running the same line again (in a loop, or from history) skips the
+ * lexer. The cache is direct mapped: a line replaces whatever was cached in
+ * its slot.
+ *
+ * Parameters:
+ * - line: line to parse
+ *
+ * Returns: the parsed line, to be handed back with parse_release(), or NULL
+ * if it cannot be parsed (the error has been reported).
+ */
+struct parsed_line *parse_line(const char *line) {
+	/* A trailing newline does not change the parse */
+	size_t len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+		len--;
+	}
+
+	size_t hash = hash_line(line, len);
+	struct parsed_line **slot = &cmd_cache[hash % CMD_CACHE_SZ];
+	if (*slot != NULL && (*slot)->hash == hash && (*slot)->key_len == len
+			&& memcmp((*slot)->key, line, len) == 0) {
+		(*slot)->users++;
+		return *slot;
+	}
+
+	struct parsed_line *pl = build_parsed(line, len, hash);
+	if (pl == NULL) {
+		return NULL;
+	}
+	LOG("Parsed and cached: %s\n", pl->key);
+	evict(*slot);
+	*slot = pl;
+	pl->cached = true;
+	pl->users++;
+	return pl;
+}
+
+/**
+ * Function to hand back a line from parse_line() once it has run
+ *
+ * Parameters:
+ * - pl: parsed line
+ *
+ * Returns: void
+ */
+void parse_release(struct parsed_line *pl) {
+	if (--pl->users == 0 && !pl->cached) {
+		free(pl);
+	}
+}
+
+/**
+ * Function to forget every cached line
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void cmd_cache_clear(void) {
+	size_t i;
+	for (i = 0; i < CMD_CACHE_SZ; i++) {
+		evict(cmd_cache[i]);
+		cmd_cache[i] = NULL;
+	}
+}
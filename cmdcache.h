@@ -0,0 +1,74 @@
+#ifndef _CMDCACHE_H_
+#define _CMDCACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "shell.h"
+
+/* Preprocessor Directives */
+#define CMD_CACHE_SZ 256
+
+/* A word of a parsed line, before expansion */
+struct parsed_word {
+	char *text;
+	size_t len;
+	int flags;
+};
+
+/* A redirection of a parsed stage */
+struct parsed_redir {
+	enum redirect_type type;
+	struct parsed_word path;
+};
+
+/* A stage of a parsed pipeline: a range of words and of redirections */
+struct parsed_stage {
+	size_t first_word;
+	size_t num_words;
+	size_t first_redir;
+	size_t num_redirs;
+};
+
+/* How a pipeline of a list joins the one before it */
+enum list_op {
+	LIST_SEQ,   /* First pipeline, or after ; or & */
+	LIST_AND,   /* && runs it if the one before succeeded */
+	LIST_OR,    /* || runs it if the one before failed */
+};
+
+/* A pipeline of a parsed list: a range of stages */
+struct parsed_pipeline {
+	int first_stage;
+	int num_stages;
+	enum list_op op;
+	bool background;
+	bool timed;     /* Prefixed with the time keyword */
+};
+
+/* Struct to store the parsed form of a line. Everything it points to lives
+ * in the same allocation. A line stays allocated while it runs even if a
+ * nested execute() pushes it out of the cache. */
+struct parsed_line {
+	size_t hash;
+	char *key;
+	size_t key_len;
+	struct parsed_word *words;
+	size_t num_words;
+	struct parsed_redir *redirs;
+	size_t num_redirs;
+	struct parsed_stage *stages;
+	int num_stages;
+	struct parsed_pipeline *pipelines;
+	int num_pipelines;
+	int users;
+	bool cached;
+};
+
+/* Function Prototypes */
+struct parsed_line *parse_line(const char *line);
+void parse_release(struct parsed_line *pl);
+void cmd_cache_clear(void);
+
+#endif
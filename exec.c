@@ -0,0 +1,725 @@
+#define _GNU_SOURCE
+
+#include "exec.h"
+#include "builtins.h"
+#include "debug.h"
+#include "pathcache.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <spawn.h>
+
+extern char **environ;
+
+/* Exit status of the last foreground pipeline */
+int last_status = 0;
+
+/* Descriptor each kind of redirection replaces, and how its file is opened */
+static const struct {
+	int fd;
+	int flags;
+} redirect_modes[] = {
+	[REDIR_IN] = { STDIN_FILENO, O_RDONLY },
+	[REDIR_OUT] = { STDOUT_FILENO, O_WRONLY | O_CREAT | O_TRUNC },
+	[REDIR_APPEND] = { STDOUT_FILENO, O_WRONLY | O_CREAT | O_APPEND },
+	[REDIR_ERR] = { STDERR_FILENO, O_WRONLY | O_CREAT | O_TRUNC },
+};
+
+/**
+ * Function to get the launcher selected by the CRASH_EXEC variable.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: EXEC_FORK if CRASH_EXEC is "fork", EXEC_SPAWN otherwise.
+ */
+enum exec_mode get_exec_mode(void) {
+	char *mode = getenv(EXEC_MODE_VAR);
+	if (mode != NULL && strcmp(mode, "fork") == 0) {
+		return EXEC_FORK;
+	}
+	return EXEC_SPAWN;
+}
+
+/**
+ * Function to report a command that could not be executed
+ *
+ * Parameters:
+ * - name: command name as typed
+ * - err: errno value describing the failure
+ *
+ * Returns: void
+ */
+static void print_exec_error(const char *name, int err) {
+	if (err == ENOENT && strchr(name, '/') == NULL) {
+		fprintf(stderr, "crash: %s: command not found\n", name);
+	} else {
+		fprintf(stderr, "crash: %s: %s\n", name, strerror(err));
+	}
+}
+
+/**
+ * Function to build the arguments that run an executable file without a #!
+ * line through EXEC_SCRIPT_SHELL, which is what execvp() does when exec
+ * fails with ENOEXEC
+ *
+ * Parameters:
+ * - path: path of the file
+ * - tokens: the command's tokens
+ *
+ * Returns: argument vector from the line arena, or NULL if memory cannot be
+ * allocated.
+ */
+static char **script_args(const char *path, char *tokens[]) {
+	size_t n = 0;
+	while (tokens[n] != NULL) {
+		n++;
+	}
+
+	char **argv = arena_alloc(&line_arena, sizeof(char *) * (n + 2));
+	if (argv == NULL) {
+		return NULL;
+	}
+	argv[0] = EXEC_SCRIPT_SHELL;
+	argv[1] = (char *)path;
+	/* The rest of the arguments and the NULL after them */
+	memcpy(argv + 2, tokens + 1, sizeof(char *) * n);
+	return argv;
+}
+
+/**
+ * Function to open the file of a redirection
+ *
+ * Parameters:
+ * - redir: redirection to open
+ *
+ * Returns: close-on-exec descriptor of the file, or -1 on error.
+ */
+static int open_redirect(const struct redirect *redir) {
+	int fd = open(redir->path, redirect_modes[redir->type].flags | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "crash: %s: %s\n", redir->path, strerror(errno));
+	}
+	return fd;
+}
+
+/**
+ * Function to apply a command's redirections, in order, to the calling
+ * process. The shell itself does this around a builtin, keeping its own
+ * descriptors in saved so they can be put back.
+ *
+ * Parameters:
+ * - cmd: command whose redirections to apply
+ * - saved: NULL in a child; otherwise filled with copies of the replaced
+ *   stdin, stdout and stderr (-1 for those left alone)
+ *
+ * Returns: 0 on success, -1 if a file cannot be opened.
+ */
+int apply_redirects(struct command_line *cmd, int saved[3]) {
+	int i;
+
+	if (saved != NULL) {
+		saved[0] = saved[1] = saved[2] = -1;
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	for (i = 0; i < cmd->num_redirs; i++) {
+		int target = redirect_modes[cmd->redirs[i].type].fd;
+		int fd = open_redirect(&cmd->redirs[i]);
+		if (fd == -1) {
+			return -1;
+		}
+		if (saved != NULL && saved[target] == -1) {
+			saved[target] = fcntl(target, F_DUPFD_CLOEXEC, 3);
+		}
+		if (dup2(fd, target) == -1) {
+			perror("dup2");
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+/**
+ * Function to put back the descriptors apply_redirects() replaced
+ *
+ * Parameters:
+ * - saved: descriptors filled in by apply_redirects()
+ *
+ * Returns: void
+ */
+void restore_redirects(int saved[3]) {
+	int fd;
+
+	fflush(stdout);
+	fflush(stderr);
+	for (fd = 0; fd < 3; fd++) {
+		if (saved[fd] != -1) {
+			dup2(saved[fd], fd);
+			close(saved[fd]);
+		}
+	}
+}
+
+/**
+ * Function to start a single pipeline stage with posix_spawn. The pipe and
+ * redirection plumbing that the fork path does with dup2() in the child is
+ * expressed as file actions instead, so the shell never has to copy its own
+ * address space. glibc implements this with clone(CLONE_VM | CLONE_VFORK).
+ * Redirected files are opened by the shell first, so a missing file is
+ * reported as such rather than as a failed exec.
+ *
+ * Parameters:
+ * - cmd: command to start
+ * - in_fd: fd to use as stdin, or -1 to inherit the shell's
+ * - out_fd: fd to use as stdout, or -1 to inherit the shell's
+ * - status: set to the stage's exit status if it could not be started
+ *
+ * Returns: pid of the new process, or -1 if it could not be started.
+ */
+static pid_t spawn_stage(struct command_line *cmd, int in_fd, int out_fd, int *status) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t pid;
+	int err = 0, i;
+	int *redir_fds = arena_alloc(&line_arena, sizeof(int) * (cmd->num_redirs + 1));
+
+	if (redir_fds == NULL) {
+		perror("spawn");
+		return -1;
+	}
+	/* Open every file before spawning; stop at the first that fails */
+	for (i = 0; i < cmd->num_redirs; i++) {
+		redir_fds[i] = open_redirect(&cmd->redirs[i]);
+		if (redir_fds[i] == -1) {
+			while (i-- > 0) {
+				close(redir_fds[i]);
+			}
+			*status = EXIT_FAILURE;
+			return -1;
+		}
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	/* Children start with no signals blocked, and with the SIGPIPE the shell
+	 * ignores back to its default */
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	if (in_fd != -1) {
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	}
+	if (out_fd != -1) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	}
+	for (i = 0; i < cmd->num_redirs; i++) {
+		posix_spawn_file_actions_adddup2(&actions, redir_fds[i],
+				redirect_modes[cmd->redirs[i].type].fd);
+	}
+
+	const char *path = path_lookup(cmd->tokens[0]);
+	if (path == NULL) {
+		err = ENOENT;
+	} else {
+		err = posix_spawn(&pid, path, &actions, &attr, cmd->tokens, environ);
+
+		/* The binary moved since it was hashed; search PATH again once */
+		if (err == ENOENT && path != cmd->tokens[0]) {
+			path_cache_remove(cmd->tokens[0]);
+			path = path_lookup(cmd->tokens[0]);
+			if (path != NULL) {
+				err = posix_spawn(&pid, path, &actions, &attr, cmd->tokens, environ);
+			}
+		}
+
+		/* An executable without a #! line is a shell script */
+		char **argv;
+		if (err == ENOEXEC && (argv = script_args(path, cmd->tokens)) != NULL) {
+			err = posix_spawn(&pid, EXEC_SCRIPT_SHELL, &actions, &attr, argv, environ);
+		}
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	for (i = 0; i < cmd->num_redirs; i++) {
+		close(redir_fds[i]);
+	}
+
+	if (err != 0) {
+		print_exec_error(cmd->tokens[0], err);
+		*status = err == ENOENT ? 127 : 126;
+		return -1;
+	}
+	LOG("Spawned %s as %d\n", cmd->tokens[0], pid);
+	trace_event(TRACE_EXEC, pid, 0, cmd->tokens[0]);
+	return pid;
+}
+
+/**
+ * Function to set up a process that is about to run a stage: default
+ * signal handling, its stdin and stdout, then its redirections
+ *
+ * Parameters:
+ * - cmd: command the child runs
+ * - in_fd: fd to use as stdin, or -1 to inherit the shell's
+ * - out_fd: fd to use as stdout, or -1 to inherit the shell's
+ *
+ * Returns: void; exits the child if its fds cannot be set up.
+ */
+static void setup_child(struct command_line *cmd, int in_fd, int out_fd) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	if (in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) {
+		perror("dup2");
+		_exit(EXIT_FAILURE);
+	}
+	if (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1) {
+		perror("dup2");
+		_exit(EXIT_FAILURE);
+	}
+	if (apply_redirects(cmd, NULL) == -1) {
+		_exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Function to start a single pipeline stage with fork and execvp. This is the
+ * fallback launcher; the child wires up its own fds before exec'ing.
+ *
+ * Parameters:
+ * - cmd: command to start
+ * - in_fd: fd to use as stdin, or -1 to inherit the shell's
+ * - out_fd: fd to use as stdout, or -1 to inherit the shell's
+ *
+ * Returns: pid of the new process, or -1 if it could not be started.
+ */
+static pid_t fork_stage(struct command_line *cmd, int in_fd, int out_fd) {
+	/* Resolve in the parent so the result stays in the hash table */
+	const char *path = path_lookup(cmd->tokens[0]);
+	if (path == NULL) {
+		print_exec_error(cmd->tokens[0], ENOENT);
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return -1;
+	}
+	if (pid > 0) {
+		/* Parent */
+		trace_event(TRACE_FORK, pid, 0, cmd->tokens[0]);
+		return pid;
+	}
+
+	/* Child */
+	setup_child(cmd, in_fd, out_fd);
+	execv(path, cmd->tokens);
+	int err = errno;
+	char **argv;
+	if (err == ENOEXEC && (argv = script_args(path, cmd->tokens)) != NULL) {
+		execv(EXEC_SCRIPT_SHELL, argv);
+	}
+	print_exec_error(cmd->tokens[0], err);
+	_exit(err == ENOENT ? 127 : 126);
+}
+
+/**
+ * Function to start an external command with the launcher picked by
+ * CRASH_EXEC
+ *
+ * Parameters:
+ * - cmd: command to start
+ * - in_fd: fd to use as stdin, or -1 to inherit the shell's
+ * - out_fd: fd to use as stdout, or -1 to inherit the shell's
+ * - status: set to the command's exit status if it could not be started
+ *
+ * Returns: pid of the new process, or -1 if it could not be started.
+ */
+pid_t start_command(struct command_line *cmd, int in_fd, int out_fd, int *status) {
+	if (get_exec_mode() == EXEC_SPAWN) {
+		return spawn_stage(cmd, in_fd, out_fd, status);
+	}
+	return fork_stage(cmd, in_fd, out_fd);
+}
+
+/**
+ * Function to run a builtin stage in a forked child. Builtins that change
+ * the shell's state (cd, setenv, ...) run this way inside a pipeline, so
+ * like in other shells their changes stay in the child.
+ *
+ * Parameters:
+ * - builtin: builtin to run
+ * - cmd: command to run
+ * - in_fd: fd to use as stdin, or -1 to inherit the shell's
+ * - out_fd: fd to use as stdout, or -1 to inherit the shell's
+ *
+ * Returns: pid of the child, or -1 if it could not be started.
+ */
+static pid_t fork_builtin_stage(const struct builtin *builtin, struct command_line *cmd, int in_fd, int out_fd) {
+	/* Don't let the child print what the shell has buffered */
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return -1;
+	}
+	if (pid > 0) {
+		/* Parent */
+		trace_event(TRACE_FORK, pid, 0, builtin->name);
+		return pid;
+	}
+
+	/* Child */
+	setup_child(cmd, in_fd, out_fd);
+	int status = builtin->fn(cmd->tokens, NULL, stdout);
+	fflush(stdout);
+	_exit(status);
+}
+
+/**
+ * Function to run a builtin stage on its thread. The stage owns its fds and
+ * closes them when done, so the stages around it see EOF.
+ *
+ * Parameters:
+ * - arg: the thread_stage to run
+ *
+ * Returns: NULL
+ */
+static void *run_thread_stage(void *arg) {
+	struct thread_stage *ts = arg;
+	struct redirect *redir = ts->cmd->num_redirs > 0 ? &ts->cmd->redirs[0] : NULL;
+	struct rusage before, after;
+	FILE *out;
+
+	thread_rusage(&before);
+
+	/* Open the stream the builtin writes to */
+	if (redir != NULL) {
+		out = fopen(redir->path, redir->type == REDIR_APPEND ? "ae" : "we");
+	} else if (ts->out_fd != -1) {
+		out = fdopen(ts->out_fd, "w");
+		ts->out_fd = -1;
+	} else {
+		int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		out = fd == -1 ? NULL : fdopen(fd, "w");
+	}
+
+	if (out == NULL) {
+		fprintf(stderr, "crash: %s: %s\n", redir != NULL
+				? redir->path : ts->cmd->tokens[0], strerror(errno));
+		ts->status = 1;
+	} else {
+		trace_event(TRACE_BUILTIN_START, 0, 0, ts->builtin->name);
+		ts->status = ts->builtin->fn(ts->cmd->tokens, NULL, out);
+		trace_event(TRACE_BUILTIN_END, 0, ts->status, ts->builtin->name);
+		fclose(out);
+	}
+
+	if (ts->out_fd != -1) {
+		close(ts->out_fd);
+	}
+	if (ts->in_fd != -1) {
+		close(ts->in_fd);
+	}
+
+	thread_rusage(&after);
+	add_rusage_delta(&ts->usage, &before, &after);
+	ts->end_ns = now_ns();
+	return NULL;
+}
+
+/**
+ * Function to check whether a builtin stage's redirections can be done by
+ * its thread, which only opens the stream it writes to
+ *
+ * Parameters:
+ * - cmd: command of the stage
+ *
+ * Returns: true if the stage has at most one redirection, of its stdout.
+ */
+static bool thread_redirects(struct command_line *cmd) {
+	return cmd->num_redirs == 0 || (cmd->num_redirs == 1
+			&& redirect_modes[cmd->redirs[0].type].fd == STDOUT_FILENO);
+}
+
+/**
+ * Function to mark the stages of a pipeline from one on as not started
+ *
+ * Parameters:
+ * - stages: stages of the pipeline
+ * - first: first stage that was not started
+ * - num_cmds: number of stages
+ * - status: exit status to give them
+ *
+ * Returns: void
+ */
+static void fail_stages(struct stage *stages, int first, int num_cmds, int status) {
+	int i;
+	for (i = first; i < num_cmds; i++) {
+		stages[i].pid = -1;
+		stages[i].status = status;
+		stages[i].thread = NULL;
+		stages[i].name = NULL;
+	}
+}
+
+/**
+ * Function to start every stage of a pipeline directly from the shell.
+ * All N-1 pipes are created with O_CLOEXEC and the shell closes its copies
+ * as soon as the stages on both ends have started, so each stage only keeps
+ * the two ends it was handed and readers see EOF as soon as their writer
+ * exits.
+ *
+ * Builtin stages of a foreground pipeline that only print (echo, history,
+ * ...) run on a thread of the shell writing into their pipe; other builtins
+ * run in a forked child. Threads are started after every process, so no
+ * child is forked while a thread runs.
+ *
+ * Parameters:
+ * - p: pipeline to start
+ * - stages: filled with each stage (pid -1 if a stage failed to start)
+ *
+ * Returns: 0 if the pipeline was launched, -1 if it could not be: a stage
+ * recalls history, or a pipe or memory could not be had.
+ */
+int launch_pipeline(struct pipeline *p, struct stage *stages) {
+	struct command_line *cmds = p->cmds;
+	int num_cmds = p->num_cmds, background = p->background;
+	int in_fd = -1, ret = 0;
+	int i;
+
+	/* "!!" and "!..." run a line in the shell; piped, each stage's child
+	 * would run the line again */
+	for (i = 0; num_cmds > 1 && i < num_cmds; i++) {
+		const struct builtin *b = cmds[i].tokens[0] == NULL ? NULL : builtin_lookup(cmds[i].tokens[0]);
+		if (b != NULL && (b->flags & BUILTIN_RECALL)) {
+			fprintf(stderr, "crash: %s: cannot recall history in a pipeline\n", cmds[i].tokens[0]);
+			fail_stages(stages, 0, num_cmds, 1);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < num_cmds; i++) {
+		int fd[2] = { -1, -1 };
+
+		stages[i].pid = -1;
+		stages[i].status = 127;
+		stages[i].thread = NULL;
+		stages[i].name = cmds[i].tokens[0];
+		stages[i].start_ns = now_ns();
+
+		/* Every stage but the last writes into a fresh pipe */
+		if (i < num_cmds - 1 && pipe2(fd, O_CLOEXEC) == -1) {
+			perror("pipe");
+			if (in_fd != -1) {
+				close(in_fd);
+			}
+			fail_stages(stages, i, num_cmds, 127);
+			ret = -1;
+			break;
+		}
+
+		const struct builtin *b = NULL;
+		if (cmds[i].tokens[0] != NULL) {
+			b = builtin_lookup(cmds[i].tokens[0]);
+		}
+		/* Background jobs use the real utilities */
+		if (b != NULL && background && (b->flags & BUILTIN_UTILITY)) {
+			b = NULL;
+		}
+
+		if (cmds[i].tokens[0] == NULL) {
+			stages[i].pid = -1;
+		} else if (b != NULL && !background && (b->flags & BUILTIN_OUTPUT)
+				&& thread_redirects(&cmds[i])) {
+			/* The thread takes over both ends; it is started below */
+			struct thread_stage *ts = arena_alloc(&line_arena, sizeof(struct thread_stage));
+			if (ts == NULL) {
+				perror("launch_pipeline");
+				if (in_fd != -1) {
+					close(in_fd);
+				}
+				if (fd[0] != -1) {
+					close(fd[0]);
+					close(fd[1]);
+				}
+				fail_stages(stages, i, num_cmds, 127);
+				ret = -1;
+				break;
+			}
+			ts->builtin = b;
+			ts->cmd = &cmds[i];
+			ts->in_fd = in_fd;
+			ts->out_fd = fd[1];
+			ts->status = 0;
+			memset(&ts->usage, 0, sizeof(struct usage));
+			stages[i].thread = ts;
+			in_fd = fd[0];
+			continue;
+		} else if (b != NULL) {
+			stages[i].pid = fork_builtin_stage(b, &cmds[i], in_fd, fd[1]);
+		} else {
+			stages[i].pid = start_command(&cmds[i], in_fd, fd[1], &stages[i].status);
+		}
+
+		/* The children hold their own copies now */
+		if (in_fd != -1) {
+			close(in_fd);
+		}
+		if (fd[1] != -1) {
+			close(fd[1]);
+		}
+		in_fd = fd[0];
+	}
+
+	/* Start the builtin stages; without a thread, run them right here */
+	for (i = 0; i < num_cmds; i++) {
+		struct thread_stage *ts = stages[i].thread;
+		if (ts == NULL) {
+			continue;
+		}
+		ts->started = pthread_create(&ts->thread, NULL, run_thread_stage, ts) == 0;
+		if (!ts->started) {
+			LOG("Running %s without a thread\n", ts->cmd->tokens[0]);
+			run_thread_stage(ts);
+		}
+	}
+	return ret;
+}
+
+/**
+ * Function to replace the shell with a command. The last command of a script
+ * runs this way, so it costs an execve() and no fork.
+ *
+ * Parameters:
+ * - cmd: command to run
+ *
+ * Returns: only if the command could not be run, with its exit status.
+ */
+int exec_command(struct command_line *cmd) {
+	const char *path = path_lookup(cmd->tokens[0]);
+	if (path == NULL) {
+		print_exec_error(cmd->tokens[0], ENOENT);
+		return 127;
+	}
+
+	/* Nothing the shell printed may be lost */
+	fflush(stdout);
+	fflush(stderr);
+
+	setup_child(cmd, -1, -1);
+	execv(path, cmd->tokens);
+	int err = errno;
+	char **argv;
+	if (err == ENOEXEC && (argv = script_args(path, cmd->tokens)) != NULL) {
+		execv(EXEC_SCRIPT_SHELL, argv);
+	}
+	print_exec_error(cmd->tokens[0], err);
+	return err == ENOENT ? 127 : 126;
+}
+
+/**
+ * Function to turn a status from waitpid() into a shell exit status
+ *
+ * Parameters:
+ * - wstatus: status filled in by waitpid()
+ *
+ * Returns: the exit code, or 128 plus the signal number if it was killed.
+ */
+int exit_status(int wstatus) {
+	if (WIFEXITED(wstatus)) {
+		return WEXITSTATUS(wstatus);
+	} else if (WIFSIGNALED(wstatus)) {
+		return 128 + WTERMSIG(wstatus);
+	}
+	return 127;
+}
+
+/**
+ * Function to reap every stage of a foreground pipeline and publish their
+ * exit statuses. The status of each stage is exported through PIPESTATUS as
+ * a space separated list, and the status of the last stage becomes the
+ * status of the pipeline. Children are reaped with wait4() so what they
+ * used is known, and each stage's latency is recorded for stats. Latencies
+ * are recorded once every thread is joined, so a "stats" stage never reads
+ * the table while it changes.
+ *
+ * Parameters:
+ * - stages: each stage of the pipeline (pid -1 and no thread for stages
+ *   that failed to start)
+ * - num_cmds: number of stages
+ * - usage: NULL, or a total to add what every stage used to
+ *
+ * Returns: exit status of the last stage.
+ */
+int wait_pipeline(struct stage *stages, int num_cmds, struct usage *usage) {
+	char pipestatus[num_cmds * 4 + 1];
+	long long latency[num_cmds];
+	size_t len = 0;
+	int i, ret = 0;
+
+	pipestatus[0] = '\0';
+	for (i = 0; i < num_cmds; i++) {
+		int status = stages[i].status;
+		latency[i] = -1;
+		if (stages[i].thread != NULL) {
+			struct thread_stage *ts = stages[i].thread;
+			if (ts->started) {
+				pthread_join(ts->thread, NULL);
+			}
+			status = ts->status;
+			latency[i] = ts->end_ns - stages[i].start_ns;
+			if (usage != NULL) {
+				usage->user_ns += ts->usage.user_ns;
+				usage->sys_ns += ts->usage.sys_ns;
+				usage->nvcsw += ts->usage.nvcsw;
+				usage->nivcsw += ts->usage.nivcsw;
+			}
+		} else if (stages[i].pid != -1) {
+			struct rusage ru;
+			int wstatus = 0;
+			pid_t pid;
+			while ((pid = wait4(stages[i].pid, &wstatus, 0, &ru)) == -1 && errno == EINTR) { }
+
+			/* The child was reaped elsewhere, so its status is lost */
+			if (pid == -1) {
+				perror("wait4");
+				status = 127;
+			} else {
+				LOG("Child %d exited. Status: %d\n", stages[i].pid, wstatus);
+				status = exit_status(wstatus);
+				trace_event(TRACE_WAIT, stages[i].pid, status, NULL);
+				latency[i] = now_ns() - stages[i].start_ns;
+				if (usage != NULL) {
+					add_rusage(usage, &ru);
+				}
+			}
+		}
+		len += sprintf(pipestatus + len, i == 0 ? "%d" : " %d", status);
+		ret = status;
+	}
+	for (i = 0; i < num_cmds; i++) {
+		if (latency[i] != -1) {
+			record_latency(stages[i].name, latency[i]);
+		}
+	}
+
+	setenv("PIPESTATUS", pipestatus, true);
+	last_status = ret;
+	return ret;
+}
@@ -0,0 +1,58 @@
+#ifndef _EXEC_H_
+#define _EXEC_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "shell.h"
+#include "stats.h"
+
+/* Environment variable used to pick the process launcher */
+#define EXEC_MODE_VAR "CRASH_EXEC"
+
+/* Shell that runs executable files without a #! line */
+#define EXEC_SCRIPT_SHELL "/bin/sh"
+
+/* Ways of starting the stages of a pipeline */
+enum exec_mode {
+	EXEC_SPAWN,
+	EXEC_FORK,
+};
+
+/* A started pipeline stage: a child process, or a builtin on a thread */
+struct stage {
+	pid_t pid;
+	int status; /* Exit status if the stage could not be started */
+	const char *name;
+	long long start_ns;
+	struct thread_stage *thread;
+};
+
+/* Struct to store a builtin stage that runs on a thread of the shell */
+struct thread_stage {
+	const struct builtin *builtin;
+	struct command_line *cmd;
+	int in_fd;
+	int out_fd;
+	int status;
+	bool started;
+	pthread_t thread;
+	struct usage usage;
+	long long end_ns;
+};
+
+/* Exit status of the last foreground pipeline */
+extern int last_status;
+
+/* Function Prototypes */
+enum exec_mode get_exec_mode(void);
+int apply_redirects(struct command_line *cmd, int saved[3]);
+void restore_redirects(int saved[3]);
+pid_t start_command(struct command_line *cmd, int in_fd, int out_fd, int *status);
+int launch_pipeline(struct pipeline *p, struct stage *stages);
+int exec_command(struct command_line *cmd);
+int exit_status(int wstatus);
+int wait_pipeline(struct stage *stages, int num_cmds, struct usage *usage);
+
+#endif
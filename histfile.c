@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+
+#include "histfile.h"
+#include "debug.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Function to map the index file and check that it describes the log. An
+ * index that fails any check is treated as empty, so the whole log is
+ * scanned and the index rewritten on close.
+ *
+ * Parameters:
+ * - hf: history file whose log is already mapped
+ *
+ * Returns: number of log bytes the index covers.
+ */
+static size_t map_index(struct hist_file *hf) {
+	struct stat st;
+	if (fstat(hf->idx_fd, &st) == -1 || (size_t)st.st_size < sizeof(struct histfile_header)) {
+		return 0;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hf->idx_fd, 0);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	hf->idx_map = map;
+	hf->idx_map_size = st.st_size;
+
+	const struct histfile_header *header = map;
+	size_t max_count = (st.st_size - sizeof(struct histfile_header)) / sizeof(uint64_t);
+	const uint64_t *offsets = (const uint64_t *)(header + 1);
+
+	if (memcmp(header->magic, HISTFILE_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != HISTFILE_VERSION
+			|| header->count > max_count
+			|| header->log_size > hf->log_size
+			|| (header->log_size > 0 && hf->log[header->log_size - 1] != '\n')
+			|| (header->count > 0 && offsets[header->count - 1] >= header->log_size)) {
+		LOG("Ignoring stale history index (%zu bytes)\n", (size_t)st.st_size);
+		return 0;
+	}
+
+	hf->offsets = offsets;
+	hf->indexed = header->count;
+	return header->log_size;
+}
+
+/**
+ * Function to find the lines of the log past the part the index covers
+ *
+ * Parameters:
+ * - hf: history file to scan
+ * - start: first byte of the log not covered by the index
+ *
+ * Returns: 0 on success, -1 if memory cannot be allocated.
+ */
+static int scan_tail(struct hist_file *hf, size_t start) {
+	size_t cap = 0;
+	const char *p = hf->log + start, *end = hf->log + hf->log_size;
+
+	while (p < end) {
+		if (hf->tail_count == cap) {
+			cap = cap == 0 ? 64 : cap * 2;
+			uint64_t *tail = realloc(hf->tail, sizeof(uint64_t) * cap);
+			if (tail == NULL) {
+				return -1;
+			}
+			hf->tail = tail;
+		}
+		hf->tail[hf->tail_count++] = p - hf->log;
+
+		const char *nl = memchr(p, '\n', end - p);
+		p = nl == NULL ? end : nl + 1;
+	}
+	return 0;
+}
+
+/**
+ * Function to open a history log and its index. Both files are mapped, so
+ * opening a large history only costs page faults for the entries that are
+ * actually read later.
+ *
+ * Parameters:
+ * - hf: filled with the opened history file
+ * - path: path of the log; the index lives next to it
+ *
+ * Returns: 0 on success, -1 if the log cannot be used.
+ */
+int hist_file_open(struct hist_file *hf, const char *path) {
+	struct stat st;
+
+	memset(hf, 0, sizeof(struct hist_file));
+	hf->idx_fd = -1;
+
+	hf->log_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (hf->log_fd == -1) {
+		return -1;
+	}
+	if (fstat(hf->log_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(hf->log_fd);
+		hf->log_fd = -1;
+		return -1;
+	}
+
+	if (st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hf->log_fd, 0);
+		if (map == MAP_FAILED) {
+			close(hf->log_fd);
+			hf->log_fd = -1;
+			return -1;
+		}
+		hf->log = map;
+		hf->log_map_size = hf->log_size = st.st_size;
+
+		/* A last line without its newline was torn by a crash; drop it */
+		if (hf->log[hf->log_size - 1] != '\n') {
+			const char *nl = memrchr(hf->log, '\n', hf->log_size);
+			hf->log_size = nl == NULL ? 0 : (size_t)(nl + 1 - hf->log);
+			if (ftruncate(hf->log_fd, hf->log_size) == -1) {
+				perror("ftruncate");
+			}
+		}
+	}
+
+	/* Without an index every entry is found by scanning the log */
+	size_t covered = 0;
+	char idx_path[strlen(path) + strlen(HISTFILE_IDX_EXT) + 1];
+	sprintf(idx_path, "%s%s", path, HISTFILE_IDX_EXT);
+	hf->idx_fd = open(idx_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (hf->idx_fd != -1) {
+		covered = map_index(hf);
+	}
+
+	if (scan_tail(hf, covered) == -1) {
+		hist_file_close(hf);
+		return -1;
+	}
+	LOG("Opened history %s: %zu indexed, %zu scanned\n", path, hf->indexed, hf->tail_count);
+	return 0;
+}
+
+/**
+ * Function to get the number of entries in the history file
+ *
+ * Parameters:
+ * - hf: history file
+ *
+ * Returns: number of entries.
+ */
+size_t hist_file_count(struct hist_file *hf) {
+	return hf->indexed + hf->tail_count;
+}
+
+/**
+ * Function to get the offset at which an entry starts in the log
+ *
+ * Parameters:
+ * - hf: history file
+ * - i: entry number
+ *
+ * Returns: offset of the entry.
+ */
+static size_t entry_offset(struct hist_file *hf, size_t i) {
+	return i < hf->indexed ? hf->offsets[i] : hf->tail[i - hf->indexed];
+}
+
+/**
+ * Function to get an entry of the history file. The line points into the
+ * mapped log and is not NUL terminated.
+ *
+ * Parameters:
+ * - hf: history file
+ * - i: entry number, 0 being the oldest
+ * - len: set to the length of the line
+ *
+ * Returns: pointer to the line.
+ */
+const char *hist_file_line(struct hist_file *hf, size_t i, size_t *len) {
+	size_t start = entry_offset(hf, i);
+	size_t end = i + 1 < hist_file_count(hf) ? entry_offset(hf, i + 1) : hf->log_size;
+
+	/* Don't trust offsets that point outside the log */
+	if (start >= end || end > hf->log_size) {
+		*len = 0;
+		return "";
+	}
+	*len = end - start - 1;
+	return hf->log + start;
+}
+
+/**
+ * Function to append a command to the log with a single write
+ *
+ * Parameters:
+ * - hf: history file
+ * - line: line to append, without a newline
+ * - len: length of the line
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int hist_file_append(struct hist_file *hf, const char *line, size_t len) {
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)line, .iov_len = len },
+		{ .iov_base = "\n", .iov_len = 1 },
+	};
+
+	if (hf->log_fd == -1) {
+		return -1;
+	}
+	return writev(hf->log_fd, iov, 2) == (ssize_t)(len + 1) ? 0 : -1;
+}
+
+/**
+ * Function to bring the index up to date and close the history file. Lines
+ * appended during this session are left for the next open to index, so
+ * only lines found by scanning at open time are added here: their offsets
+ * are written first, then the header that counts them.
+ *
+ * Parameters:
+ * - hf: history file to close
+ *
+ * Returns: void
+ */
+void hist_file_close(struct hist_file *hf) {
+	if (hf->idx_fd != -1 && hf->tail_count > 0) {
+		struct histfile_header header;
+		memcpy(header.magic, HISTFILE_MAGIC, sizeof(header.magic));
+		header.version = HISTFILE_VERSION;
+		header.reserved = 0;
+		header.log_size = hf->log_size;
+		header.count = hist_file_count(hf);
+
+		off_t at = sizeof(header) + hf->indexed * sizeof(uint64_t);
+		size_t tail_sz = hf->tail_count * sizeof(uint64_t);
+		if (pwrite(hf->idx_fd, hf->tail, tail_sz, at) != (ssize_t)tail_sz
+				|| pwrite(hf->idx_fd, &header, sizeof(header), 0) != sizeof(header)) {
+			perror("history index");
+		}
+	}
+
+	if (hf->idx_map != NULL) {
+		munmap(hf->idx_map, hf->idx_map_size);
+	}
+	if (hf->log != NULL) {
+		munmap((void *)hf->log, hf->log_map_size);
+	}
+	if (hf->idx_fd != -1) {
+		close(hf->idx_fd);
+	}
+	if (hf->log_fd != -1) {
+		close(hf->log_fd);
+	}
+	free(hf->tail);
+	memset(hf, 0, sizeof(struct hist_file));
+	hf->log_fd = hf->idx_fd = -1;
+}
@@ -0,0 +1,61 @@
+#ifndef _HISTFILE_H_
+#define _HISTFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Preprocessor Directives */
+#define HISTFILE_IDX_EXT ".idx"
+#define HISTFILE_MAGIC "CRASHIDX"
+#define HISTFILE_VERSION 1
+
+/**
+ * On-disk history is two files:
+ *
+ * - The log (~/.crash_history) holds one command per line, each ending in a
+ *   newline. It is only ever appended to, with a single write per command.
+ * - The index (~/.crash_history.idx) is a header followed by the offset at
+ *   which each line of the log starts. It lets the shell find entry N
+ *   without reading the log.
+ *
+ * Crash consistency: the log is the source of truth and the index is a
+ * cache of it. A record without its trailing newline was torn by a crash
+ * and is cut off the log the next time it is opened. The index header
+ * records how much of the log it covers; lines past that point (from
+ * sessions that did not exit cleanly, or from other shells) are found by
+ * scanning just that tail. New offsets are written before the header that
+ * counts them, so a crash in between leaves a valid, shorter index. An
+ * index that does not match the log is ignored and rebuilt.
+ */
+struct histfile_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t log_size;
+	uint64_t count;
+};
+
+/* An opened history log and its index, both mapped read-only */
+struct hist_file {
+	int log_fd;
+	int idx_fd;
+	const char *log;
+	size_t log_size;
+	size_t log_map_size;
+	const uint64_t *offsets;
+	size_t indexed;
+	size_t idx_map_size;
+	void *idx_map;
+	uint64_t *tail;
+	size_t tail_count;
+};
+
+/* Function Prototypes */
+int hist_file_open(struct hist_file *hf, const char *path);
+size_t hist_file_count(struct hist_file *hf);
+const char *hist_file_line(struct hist_file *hf, size_t i, size_t *len);
+int hist_file_append(struct hist_file *hf, const char *line, size_t len);
+void hist_file_close(struct hist_file *hf);
+
+#endif
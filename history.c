@@ -1,14 +1,48 @@
+#define _GNU_SOURCE
+
 #include "history.h"
+#include "histfile.h"
 #include "shell.h"
-#include "queue.h"
 #include "tokenizer.h"
+#include "trie.h"
+#include "ngram.h"
 
 /* Globals */
-struct Queue *history;
-int size;
+struct history_entry *history;
+size_t hist_cap, hist_start, hist_count;
+struct trie hist_index;
+
+/* Commands from earlier sessions stay in the mapped history file. They have
+ * cmd ids [0, file_end), of which [file_start, file_end) are still visible;
+ * commands of this session follow them in the ring. The prefix index covers
+ * [file_index_start, file_end) of them and grows towards older entries. */
+struct hist_file hist_file;
+bool hist_file_loaded;
+int file_start, file_end, file_index_start;
+
+/* Substring index for reverse search. It covers cmd ids [search_first,
+ * search_next) and is brought up to date lazily, so adding a command
+ * costs nothing. */
+struct ngram_index search_index;
+int search_first = -1, search_next;
+
+/**
+ * Function to get the text of an entry for the prefix index, whose labels
+ * point into the entries instead of copying them
+ *
+ * Parameters:
+ * - cmd_id: cmd id of a visible entry
+ *
+ * Returns: the line of the entry, or NULL if it is not visible.
+ */
+static const char *entry_text(int cmd_id) {
+	struct history_entry entry;
+	return get_entry(cmd_id, &entry) ? entry.line : NULL;
+}
 
 /**
- * Function to set up history queue 
+ * Function to set up history ring buffer. Its capacity comes from HISTSIZE
+ * if that is set, otherwise HIST_MAX.
  *
  * Parameters:
  * - void
@@ -16,75 +50,244 @@ int size;
  * Returns: void
  */
 void init_history(void) {
-	history = createQueue();
-	size = 0;
+	char *histsize = getenv(HISTSIZE_VAR);
+	int cap = histsize == NULL ? 0 : atoi(histsize);
+
+	history = NULL;
+	hist_cap = hist_start = hist_count = 0;
+	trie_init(&hist_index, entry_text);
+	ngram_init(&search_index);
+	set_history_size(cap > 0 ? cap : HIST_MAX);
 }
 
-/** 
- * Function to add command entry to history of command entries 
+/**
+ * Function to load the history of earlier sessions. The file is mapped, not
+ * read: entries are only touched when they are listed or recalled.
  *
  * Parameters:
- * - cmd_id: cmd number to add to history
- * - line: line to add to history
+ * - path: path of the history file
+ *
+ * Returns: cmd id of the first command of this session.
+ */
+int load_history(const char *path) {
+	if (hist_file_open(&hist_file, path) == -1) {
+		return 0;
+	}
+	hist_file_loaded = true;
+
+	/* Only the newest HISTSIZE entries are visible */
+	file_end = hist_file_count(&hist_file);
+	file_start = (size_t)file_end > hist_cap ? file_end - (int)hist_cap : 0;
+	file_index_start = file_end;
+	return file_end;
+}
+
+/**
+ * Function to close the history file, bringing its index up to date
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void close_history(void) {
+	if (hist_file_loaded) {
+		hist_file_close(&hist_file);
+		hist_file_loaded = false;
+	}
+}
+
+/**
+ * Function to get the entry at a position in the ring
+ *
+ * Parameters:
+ * - i: position, 0 being the oldest entry
+ *
+ * Returns: history entry at that position.
+ */
+static struct history_entry *entry_at(size_t i) {
+	return &history[(hist_start + i) % hist_cap];
+}
+
+/**
+ * Function to get an entry of the history file
+ *
+ * Parameters:
+ * - cmd_id: cmd id of the entry, below file_end
+ * - entry: filled with the entry
  *
  * Returns: void
  */
-void add_history(int cmd_id, char *line) {
-	/* If not valid, then don't add to history */
-	if (strcmp(line, "") == 0) {
+static void file_entry(int cmd_id, struct history_entry *entry) {
+	entry->cmd_id = cmd_id;
+	entry->line = hist_file_line(&hist_file, cmd_id, &entry->len);
+}
+
+/**
+ * Function to get the number of visible entries
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: entries from the history file plus entries in the ring.
+ */
+static size_t visible_count(void) {
+	return (size_t)(file_end - file_start) + hist_count;
+}
+
+/**
+ * Function to drop the oldest visible entry. Entries of the history file are
+ * older than any in the ring, so they go first.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+static void drop_oldest(void) {
+	if (file_start < file_end) {
+		if (file_start >= file_index_start) {
+			struct history_entry entry;
+			file_entry(file_start, &entry);
+			trie_remove(&hist_index, entry.line, entry.len);
+		}
+		file_start++;
+		if (file_index_start < file_start) {
+			file_index_start = file_start;
+		}
+		return;
+	}
+
+	struct history_entry *oldest = entry_at(0);
+	trie_remove(&hist_index, oldest->line, oldest->len);
+	free((char *)oldest->line);
+	hist_start = (hist_start + 1) % hist_cap;
+	hist_count--;
+}
+
+/**
+ * Function to change how many entries the history keeps. The newest entries
+ * are kept and the rest are freed.
+ *
+ * Parameters:
+ * - cap: new capacity, at least 1
+ *
+ * Returns: void
+ */
+void set_history_size(size_t cap) {
+	if (cap == 0 || cap == hist_cap) {
 		return;
 	}
+
+	struct history_entry *resized = malloc(sizeof(struct history_entry) * cap);
+	if (resized == NULL) {
+		perror("malloc");
+		return;
+	}
+
+	/* Drop the oldest entries that no longer fit */
+	while (visible_count() > cap) {
+		drop_oldest();
+	}
+
+	size_t i;
+	for (i = 0; i < hist_count; i++) {
+		resized[i] = *entry_at(i);
+	}
+	free(history);
+	history = resized;
+	hist_cap = cap;
+	hist_start = 0;
+
+	/* A larger history shows more of the file again. Those entries are
+	 * older than any indexed one, so they are indexed later. */
+	while (file_start > 0 && visible_count() < cap) {
+		file_start--;
+	}
+}
+
+/** 
+ * Function to add command entry to history of command entries. If a history
+ * file is loaded, the entry is also appended to it.
+ *
+ * Parameters:
+ * - cmd_id: cmd number to add to history
+ * - line: line to add to history; the history takes ownership of it. NULL
+ *   if it could not be copied, and then nothing is added.
+ *
+ * Returns: true if an entry was added, false if not.
+ */
+bool add_history(int cmd_id, char *line) {
+	if (line == NULL) {
+		perror("history");
+		return false;
+	}
+
+	/* If not valid (blank), then don't add to history */
+	if (line[strspn(line, " \t\r\n")] == '\0') {
+		free(line);
+		return false;
+	}
 	
-	/* Else if line starts with !!, get last command */
-	else if (strncmp(line, "!!", strlen("!!")) == 0) {
-		struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
-		temp = get_last_entry();
-		/* Check if last entry exists */
-		if (temp != NULL) {
-			strcpy(line, temp->line);
+	/* Else if line starts with !, store the command it refers to instead */
+	else if (startsWith("!", line + strspn(line, " \t"))) {
+		char *arg = line + strspn(line, " \t");
+		struct history_entry temp;
+		bool found;
+
+		/* "!!" refers to the last command */
+		if (strncmp(arg, "!!", strlen("!!")) == 0) {
+			found = get_last_entry(&temp);
 		} else {
-			return;
-		}
-	}
+			/* Get line without ! */
+			arg += strspn(arg, "!");
+			arg[strcspn(arg, "!\r\n")] = '\0';
 
-	/* Else if line starts with !, get line without ! */
-	else if (startsWith("!", line)) {
-		line = next_token(&line, "!");
+			/* Check if argument is cmd id */
+			int id = atoi(arg);
+			if (id > 0) {
+				found = get_entry(id, &temp);
+			}
 
-		/* Check if argument is cmd id */
-		int cmd_id = atoi(line);
-		if (cmd_id > 0) {
-			struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
-			temp = get_entry(cmd_id);
-			if (temp != NULL) {
-				strcpy(line, temp->line);
+			/* If argument is line */
+			else {
+				found = get_entry_by_line(arg, cmd_id - 1, &temp);
 			}
 		}
 
-		/* If argument is line */
-		else {
-			int found = 1;
-			struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
-			temp = get_entry_by_line(line, &found);
-			/* If found latest command */
-			if (found == 0) {
-				strcpy(line, temp->line);
-			}
+		/* Nothing to refer to, so nothing to add */
+		free(line);
+		if (!found) {
+			return false;
+		}
+		line = strndup(temp.line, temp.len);
+		if (line == NULL) {
+			perror("history");
+			return false;
 		}
 	}
 
-	/* If history is at max size, then remove first in list */
-	if (size >= HIST_MAX) {
-		deQueue(history);
-		size--;
+	/* Newlines are not part of the entry */
+	size_t len = strcspn(line, "\r\n");
+	line[len] = '\0';
+
+	/* If history is at max size, then drop the oldest entry */
+	if (visible_count() == hist_cap) {
+		drop_oldest();
 	}
 
-	/* Create history entry and add to list */
-	struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
+	/* Store entry in the next free slot */
+	struct history_entry *temp = entry_at(hist_count);
 	temp->cmd_id = cmd_id;
 	temp->line = line;
-	enQueue(history, temp);
-	size++;
+	temp->len = len;
+	hist_count++;
+	trie_insert(&hist_index, line, len, cmd_id);
+
+	if (hist_file_loaded && hist_file_append(&hist_file, line, len) == -1) {
+		perror("history");
+	}
+	return true;
 }
 
 /**
@@ -92,97 +295,243 @@ void add_history(int cmd_id, char *line) {
  *
  * Parameters:
  * - cmd_id: cmd id to get history entry
+ * - entry: filled with the entry if it exists
  *
- * Returns: struct by cmd id.
+ * Returns: true if the entry exists, false if not.
  */
-struct history_entry *get_entry(int cmd_id) {
+bool get_entry(int cmd_id, struct history_entry *entry) {
+	/* Entries of the history file are found through its index */
+	if (cmd_id >= file_start && cmd_id < file_end) {
+		file_entry(cmd_id, entry);
+		return true;
+	}
+
 	/* Check if cmd id is not accessible */
-	if (cmd_id < size - 100) {
-		perror("Event not found\n");
-		return NULL;
+	if (hist_count == 0) {
+		return false;
 	}
 
-	/* Traverse history entries */
-	struct QNode *node = history->front;
-	while (node != NULL) {
-		/* If cmd id matches, return entry */
-		if (cmd_id == node->entry->cmd_id) {
-			return node->entry;
+	/* Command ids are consecutive, so the id gives the position directly */
+	int first_id = entry_at(0)->cmd_id;
+	if (cmd_id < first_id || (size_t)(cmd_id - first_id) >= hist_count) {
+		return false;
+	}
+	*entry = *entry_at(cmd_id - first_id);
+	return true;
+}
+
+/**
+ * Function to add more entries of the history file to the prefix index,
+ * newest first. Sessions that never search never read the file, and a large
+ * file is indexed a few entries at a time.
+ *
+ * Parameters:
+ * - max: most entries to index in this call
+ *
+ * Returns: number of entries indexed.
+ */
+static size_t index_file_lines(size_t max) {
+	struct history_entry entry;
+	size_t n;
+
+	for (n = 0; n < max && file_index_start > file_start; n++) {
+		file_index_start--;
+		file_entry(file_index_start, &entry);
+		trie_insert(&hist_index, entry.line, entry.len, file_index_start);
+	}
+	return n;
+}
+
+/**
+ * Function to get last history entry by line, skipping entries newer than
+ * the line being run. The prefix index gives the newest matching entry in
+ * time proportional to the length of the prefix. Entries of the history file
+ * that are not indexed yet are older than all that are, so they are only
+ * compared in place, newest first, when the index has no match.
+ *
+ * Parameters:
+ * - prefix: beginning of the line to look for
+ * - before: newest cmd id to consider; at most the newest entry is skipped
+ * - entry: filled with the entry if one matches
+ *
+ * Returns: true if an entry starts with prefix, false if not.
+ */
+bool get_entry_by_line(const char *prefix, int before, struct history_entry *entry) {
+	size_t len = strlen(prefix);
+	int cmd_id;
+
+	index_file_lines(HIST_INDEX_STEP);
+	cmd_id = trie_latest(&hist_index, prefix, len, before);
+	if (cmd_id != -1) {
+		return get_entry(cmd_id, entry);
+	}
+
+	for (cmd_id = file_index_start - 1; cmd_id >= file_start; cmd_id--) {
+		file_entry(cmd_id, entry);
+		if (cmd_id <= before && entry->len >= len && memcmp(entry->line, prefix, len) == 0) {
+			return true;
 		}
-		node = node->next;
 	}
+	return false;
+}
 
-	/* If not found, return null */
-	return NULL;
+/**
+ * Function to get the cmd ids of the oldest and newest visible entries
+ *
+ * Parameters:
+ * - first: set to the cmd id of the oldest entry
+ * - last: set to the cmd id of the newest entry
+ *
+ * Returns: true if there are entries, false if the history is empty.
+ */
+bool get_history_range(int *first, int *last) {
+	if (visible_count() == 0) {
+		return false;
+	}
+	*first = file_start < file_end ? file_start : entry_at(0)->cmd_id;
+	*last = hist_count > 0 ? entry_at(hist_count - 1)->cmd_id : file_end - 1;
+	return true;
 }
 
 /**
- * Function to get last history entry by line 
+ * Function to bring the search index up to date with the history. Entries
+ * are indexed in order, so only the ones added since the last call are
+ * read. The index starts over if older entries became visible again, or
+ * once more entries were dropped than the history holds, so its size stays
+ * in proportion to the history. The line editor calls this while waiting
+ * for keys, a few entries at a time, so a large history is indexed before
+ * the first search. Entries of the history file are added to the prefix
+ * index first.
  *
  * Parameters:
- * - line: line to get history entry
- * - found: int to determine if history entry was found
+ * - max: most entries to index in this call
  *
- * Returns: struct history entry with cmd id.
+ * Returns: true if the index is up to date.
  */
-struct history_entry *get_entry_by_line(char *line, int *found) {
-	struct history_entry *latest = (struct history_entry*)malloc(sizeof(struct history_entry));
-	int i = 1;
+bool index_history(size_t max) {
+	struct history_entry entry;
+	int first, last;
 
-	/* Traverse history entries */
-	struct QNode *node = history->front;
-	while (node != NULL && i < size) {
-		char *history_line = node->entry->line;
-		history_line[strlen(history_line)-1] = '\0';
-		/* If line matches, set to latest entry */
-		if (startsWith(line, history_line)) {
-			latest = node->entry;
-			*found = 0;
+	max -= index_file_lines(max);
+	if (!get_history_range(&first, &last)) {
+		return true;
+	}
+	/* Start over if older entries became visible again, or once the history
+	 * has been replaced, so dropped lines do not pile up in the index */
+	if (search_first == -1 || first < search_first || (size_t)(first - search_first) > hist_cap) {
+		ngram_free(&search_index);
+		search_first = search_next = first;
+	}
+	for (; search_next <= last && max > 0; search_next++, max--) {
+		if (get_entry(search_next, &entry)) {
+			ngram_insert(&search_index, entry.line, entry.len, search_next);
 		}
-		node = node->next;
-		i++;
 	}
+	return search_next > last && file_index_start == file_start;
+}
+
+/**
+ * Function to find the newest entry that contains a string, for reverse
+ * search. Only the entries that contain the rarest n-gram of the query
+ * are looked at; for queries of up to NGRAM_MAX characters those are
+ * exactly the matches.
+ *
+ * Parameters:
+ * - query: text to look for
+ * - len: length of the query
+ * - before: newest cmd id to consider
+ * - entry: filled with the entry if one matches
+ *
+ * Returns: true if an entry contains the query, false if not.
+ */
+bool search_history(const char *query, size_t len, int before, struct history_entry *entry) {
+	size_t n = len < NGRAM_MAX ? len : NGRAM_MAX, i;
+	int first, last;
 
-	return latest;
+	if (len == 0 || !get_history_range(&first, &last)) {
+		return false;
+	}
+	index_history(SIZE_MAX);
+
+	/* Every n-gram of the query must occur; check the rarest one's lines */
+	struct ngram_list *rarest = NULL;
+	for (i = 0; i + n <= len; i++) {
+		struct ngram_list *list = ngram_find(&search_index, query + i, n);
+		if (list == NULL) {
+			return false;
+		}
+		/* Forget lines that were dropped from the history */
+		while (list->start < list->len && list->ids[list->start] < first) {
+			list->start++;
+		}
+		if (rarest == NULL || list->len - list->start < rarest->len - rarest->start) {
+			rarest = list;
+		}
+	}
+
+	/* Find the newest line at or before the cut-off, then walk back */
+	size_t lo = rarest->start, hi = rarest->len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (rarest->ids[mid] <= before) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (i = lo; i > rarest->start; i--) {
+		if (get_entry(rarest->ids[i - 1], entry) && memmem(entry->line, entry->len, query, len) != NULL) {
+			return true;
+		}
+	}
+	return false;
 }
 
 /**
  * Function to get last history entry in list 
  *
  * Parameters:
- * - void
+ * - entry: filled with the last entry if there is one
  *
- * Returns: last struct history entry in history list.
+ * Returns: true if there is an entry, false if the history is empty.
  **/
-struct history_entry *get_last_entry(void) {
-	/* If not null, return last entry in list */
-	if (history->rear != NULL) {
-		if (history->rear->entry != NULL) {
-			return history->rear->entry;
-		}
+bool get_last_entry(struct history_entry *entry) {
+	if (hist_count > 0) {
+		*entry = *entry_at(hist_count - 1);
+		return true;
+	}
+	if (file_start < file_end) {
+		file_entry(file_end - 1, entry);
+		return true;
 	}
 
-	/* If nothing in list, return null */
-	return NULL;
+	/* If nothing in list, there is no last entry */
+	return false;
 }
 
 /**
  * Function to print history entries 
  *
  * Parameters: 
- * - void
+ * - out: stream to print to
  *
  * Returns: void
  */
-void print_history(void) {
+void print_history(FILE *out) {
+	struct history_entry entry;
+	int cmd_id;
+	size_t i;
+
+	/* Entries of the history file come before this session's */
+	for (cmd_id = file_start; cmd_id < file_end; cmd_id++) {
+		file_entry(cmd_id, &entry);
+		fprintf(out, "%d %.*s\n", entry.cmd_id, (int)entry.len, entry.line);
+	}
+
 	/* Traverse history entries */
-	struct QNode *node = history->front;
-	while (node != NULL) {
+	for (i = 0; i < hist_count; i++) {
 		/* Get history info and print to shell */
-		int cmd_id = node->entry->cmd_id;
-		char *line = node->entry->line;
-		printf("%d %s", cmd_id, line);
-		node = node->next; 
+		struct history_entry *temp = entry_at(i);
+		fprintf(out, "%d %.*s\n", temp->cmd_id, (int)temp->len, temp->line);
 	}
 }
-
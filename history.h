@@ -7,20 +7,32 @@
 
 /* Preprocessor Directives */
 #define HIST_MAX 100
+#define HISTSIZE_VAR "HISTSIZE"
+#define HISTFILE_VAR "HISTFILE"
+#define HISTFILE_NAME ".crash_history"
 #define BUF_SZ 128
+#define HIST_INDEX_STEP 1024   /* History file entries indexed per prefix search */
 
-/* Struct to store information of each command entry */
+/* Struct to store information of each command entry; line is not NUL
+ * terminated when it points into the history file */
 struct history_entry {
 	int cmd_id;
-	char *line;
+	const char *line;
+	size_t len;
 };
 
 /* Function Prototypes */
 void init_history(void);
-void add_history(int cmd_id, char *line);
-struct history_entry *get_entry(int cmd_id);
-struct history_entry *get_entry_by_line(char *line, int *found);
-struct history_entry *get_last_entry(void);
-void print_history(void);
+int load_history(const char *path);
+void close_history(void);
+void set_history_size(size_t cap);
+bool add_history(int cmd_id, char *line);
+bool get_entry(int cmd_id, struct history_entry *entry);
+bool get_entry_by_line(const char *prefix, int before, struct history_entry *entry);
+bool get_last_entry(struct history_entry *entry);
+bool get_history_range(int *first, int *last);
+bool index_history(size_t max);
+bool search_history(const char *query, size_t len, int before, struct history_entry *entry);
+void print_history(FILE *out);
 
 #endif
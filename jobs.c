@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+
+#include "jobs.h"
+#include "debug.h"
+#include "exec.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Globals */
+struct job *job_table;
+size_t job_table_sz, job_end, job_count;
+struct job_slot *pid_map;
+size_t pid_map_sz;
+int job_epoll = -1, input_fd = -1;
+
+/* Exit statuses of the last JOB_STATUS_MAX jobs reported, so "wait <pid>"
+ * still works after a job left the table */
+struct job_status reported[JOB_STATUS_MAX];
+size_t reported_next;
+
+/**
+ * Function to set up the job table and the epoll instance that watches
+ * input and running jobs. Each job gets a pidfd that becomes readable when
+ * it exits, so jobs are reaped without a SIGCHLD handler.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void init_jobs(void) {
+	job_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (job_epoll == -1) {
+		perror("epoll_create1");
+	}
+}
+
+/**
+ * Function to hash a pid (Fibonacci hashing)
+ *
+ * Parameters:
+ * - pid: pid to hash
+ *
+ * Returns: hash of the pid.
+ */
+static size_t hash_pid(pid_t pid) {
+	return (size_t)((uint32_t)pid * 2654435761U);
+}
+
+/**
+ * Function to find the map slot of a pid, or the empty slot it would be
+ * inserted into. The map is open addressed with linear probing.
+ *
+ * Parameters:
+ * - pid: pid to find
+ *
+ * Returns: pointer to the matching or empty slot.
+ */
+static struct job_slot *find_slot(pid_t pid) {
+	size_t mask = pid_map_sz - 1;
+	size_t i = hash_pid(pid) & mask;
+	while (pid_map[i].pid != 0 && pid_map[i].pid != pid) {
+		i = (i + 1) & mask;
+	}
+	return &pid_map[i];
+}
+
+/**
+ * Function to double the size of the pid map and rehash every entry
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: false if memory cannot be allocated, true otherwise.
+ */
+static bool grow_map(void) {
+	struct job_slot *old = pid_map;
+	size_t old_sz = pid_map_sz, i;
+	size_t sz = old_sz == 0 ? JOB_TABLE_INIT_SZ : old_sz * 2;
+
+	struct job_slot *map = calloc(sz, sizeof(struct job_slot));
+	if (map == NULL) {
+		perror("calloc");
+		return false;
+	}
+	pid_map = map;
+	pid_map_sz = sz;
+	for (i = 0; i < old_sz; i++) {
+		if (old[i].pid != 0) {
+			*find_slot(old[i].pid) = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+/**
+ * Function to add a background job. Jobs are numbered in the order they
+ * start, so the job goes after the newest one still in the table.
+ *
+ * Parameters:
+ * - pid: pid of the job's last stage
+ * - cmd: command line of the job; the table takes ownership of it
+ *
+ * Returns: the new job, or NULL if memory cannot be allocated.
+ */
+struct job *add_job(pid_t pid, char *cmd) {
+	/* Keep the load factor of the pid map at or below one half */
+	if ((job_count + 1) * 2 > pid_map_sz && !grow_map()) {
+		free(cmd);
+		return NULL;
+	}
+
+	if (job_end == job_table_sz) {
+		size_t sz = job_table_sz == 0 ? JOB_TABLE_INIT_SZ : job_table_sz * 2;
+		struct job *table = realloc(job_table, sizeof(struct job) * sz);
+		if (table == NULL) {
+			perror("realloc");
+			free(cmd);
+			return NULL;
+		}
+		job_table = table;
+		job_table_sz = sz;
+	}
+
+	struct job_slot *slot = find_slot(pid);
+	slot->pid = pid;
+	slot->slot = job_end;
+
+	struct job *job = &job_table[job_end];
+	job->pid = pid;
+	job->cmd = cmd;
+	job->done = false;
+	job->status = 0;
+	job_end++;
+	job_count++;
+
+	/* Without a pidfd the job is still reaped before the next prompt */
+	job->pidfd = pidfd_open(pid, 0);
+	if (job->pidfd != -1 && job_epoll != -1) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.fd = job->pidfd };
+		epoll_ctl(job_epoll, EPOLL_CTL_ADD, job->pidfd, &ev);
+	}
+	return job;
+}
+
+/**
+ * Function to find a job by the pid of its last stage
+ *
+ * Parameters:
+ * - pid: pid to find
+ *
+ * Returns: the job, or NULL if no job has that pid.
+ */
+struct job *find_job(pid_t pid) {
+	if (pid_map_sz == 0 || pid <= 0) {
+		return NULL;
+	}
+	struct job_slot *slot = find_slot(pid);
+	return slot->pid == 0 ? NULL : &job_table[slot->slot];
+}
+
+/**
+ * Function to find a job by job number ("%2") or pid ("1234")
+ *
+ * Parameters:
+ * - spec: job number after a '%', or a pid
+ *
+ * Returns: the job, or NULL if there is no such job.
+ */
+struct job *find_job_spec(const char *spec) {
+	if (spec[0] == '%') {
+		int n = atoi(spec + 1);
+		if (n < 1 || (size_t)n > job_end || job_table[n - 1].pid == 0) {
+			return NULL;
+		}
+		return &job_table[n - 1];
+	}
+	return find_job(atoi(spec));
+}
+
+/**
+ * Function to get the number a job is listed and referred to by
+ *
+ * Parameters:
+ * - job: job in the table
+ *
+ * Returns: job number, starting at 1.
+ */
+size_t job_number(struct job *job) {
+	return job - job_table + 1;
+}
+
+/**
+ * Helper function to delete job struct from jobs list
+ *
+ * Parameters:
+ * - pid: pid to delete
+ *
+ * Returns: void
+ */ 
+void delete_job(pid_t pid) { 
+	if (pid_map_sz == 0 || pid <= 0) {
+		return;
+	}
+
+	struct job_slot *slot = find_slot(pid);
+	if (slot->pid == 0) {
+		return;
+	}
+
+	/* Free the job's slot; trailing free slots are reused by the next job */
+	struct job *job = &job_table[slot->slot];
+	if (job->pidfd != -1) {
+		close(job->pidfd);
+	}
+	free(job->cmd);
+	job->pid = 0;
+	job->cmd = NULL;
+	job_count--;
+	while (job_end > 0 && job_table[job_end - 1].pid == 0) {
+		job_end--;
+	}
+
+	/* Reinsert the rest of the probe run so lookups don't stop early */
+	slot->pid = 0;
+	size_t mask = pid_map_sz - 1;
+	size_t i = ((size_t)(slot - pid_map) + 1) & mask;
+	while (pid_map[i].pid != 0) {
+		struct job_slot moved = pid_map[i];
+		pid_map[i].pid = 0;
+		*find_slot(moved.pid) = moved;
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * Function to record that a job exited. Its pidfd is closed, which also
+ * takes it out of the epoll set.
+ *
+ * Parameters:
+ * - job: job that exited
+ * - wstatus: status from waitpid()
+ *
+ * Returns: void
+ */
+static void finish_job(struct job *job, int wstatus) {
+	job->done = true;
+	job->status = exit_status(wstatus);
+	if (job->pidfd != -1) {
+		close(job->pidfd);
+		job->pidfd = -1;
+	}
+}
+
+/**
+ * Function to reap every child that has exited, without blocking. Jobs are
+ * marked done; other children, like the first stages of background
+ * pipelines, are just reaped.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void reap_jobs(void) {
+	pid_t pid;
+	int wstatus;
+
+	while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+		LOG("Child %d exited. Status: %d\n", pid, wstatus);
+		trace_event(TRACE_WAIT, pid, exit_status(wstatus), NULL);
+		struct job *job = find_job(pid);
+		if (job != NULL) {
+			finish_job(job, wstatus);
+		}
+	}
+}
+
+/**
+ * Function to block until a file descriptor is readable. Jobs that exit in
+ * the meantime are reaped as soon as their pidfd fires.
+ *
+ * Parameters:
+ * - fd: file descriptor to wait for, usually stdin
+ *
+ * Returns: true once fd is readable, false if waiting is not possible.
+ */
+bool wait_for_input(int fd) {
+	struct epoll_event events[JOB_EVENTS_MAX];
+	int i, n;
+
+	if (job_epoll == -1) {
+		return false;
+	}
+	if (fd != input_fd) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+		if (epoll_ctl(job_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			return false;
+		}
+		input_fd = fd;
+	}
+
+	while (true) {
+		n = epoll_wait(job_epoll, events, JOB_EVENTS_MAX, -1);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			return false;
+		}
+
+		bool readable = false;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == fd) {
+				readable = true;
+			}
+		}
+		if (n > (int)readable) {
+			reap_jobs();
+		}
+		if (readable) {
+			return true;
+		}
+	}
+}
+
+/**
+ * Function to wait for a job to finish and take it out of the table
+ *
+ * Parameters:
+ * - job: job to wait for
+ *
+ * Returns: exit status of the job.
+ */
+int wait_job(struct job *job) {
+	int wstatus;
+
+	if (!job->done) {
+		while (waitpid(job->pid, &wstatus, 0) == -1) {
+			if (errno != EINTR) {
+				/* Someone else reaped it; its status is lost */
+				wstatus = 127 << 8;
+				break;
+			}
+		}
+		trace_event(TRACE_WAIT, job->pid, exit_status(wstatus), NULL);
+		finish_job(job, wstatus);
+	}
+
+	int status = job->status;
+	delete_job(job->pid);
+	return status;
+}
+
+/**
+ * Function to wait for every job to finish and take them out of the table
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void wait_all_jobs(void) {
+	size_t i;
+	for (i = 0; i < job_end; i++) {
+		if (job_table[i].pid != 0) {
+			wait_job(&job_table[i]);
+		}
+	}
+}
+
+/**
+ * Function to wait for the next job to finish and take it out of the table.
+ * A job that already finished but was not reported yet counts as next.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: exit status of the job, or 127 if there are no jobs.
+ */
+int wait_any_job(void) {
+	size_t i;
+	pid_t pid;
+	int wstatus;
+
+	reap_jobs();
+	for (i = 0; i < job_end; i++) {
+		if (job_table[i].pid != 0 && job_table[i].done) {
+			return wait_job(&job_table[i]);
+		}
+	}
+
+	/* Children that are not jobs are reaped and skipped */
+	while (job_count > 0) {
+		pid = waitpid(-1, &wstatus, 0);
+		if (pid == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		trace_event(TRACE_WAIT, pid, exit_status(wstatus), NULL);
+		struct job *job = find_job(pid);
+		if (job != NULL) {
+			finish_job(job, wstatus);
+			return wait_job(job);
+		}
+	}
+	return 127;
+}
+
+/**
+ * Function to report jobs that finished and take them out of the table.
+ * Scripts call this without printing after reaping, so a script that
+ * starts many jobs does not grow the table; the status of each job is kept
+ * for reported_status().
+ *
+ * Parameters:
+ * - print: true to print a line for each finished job
+ *
+ * Returns: void
+ */
+void notify_jobs(bool print) {
+	size_t i;
+
+	for (i = 0; i < job_end; i++) {
+		struct job *job = &job_table[i];
+		if (job->pid == 0 || !job->done) {
+			continue;
+		}
+		if (print) {
+			if (job->status == 0) {
+				fprintf(stderr, "[%zu] Done\t%s", i + 1, job->cmd);
+			} else {
+				fprintf(stderr, "[%zu] Exit %d\t%s", i + 1, job->status, job->cmd);
+			}
+		}
+		reported[reported_next].pid = job->pid;
+		reported[reported_next].status = job->status;
+		reported_next = (reported_next + 1) % JOB_STATUS_MAX;
+		delete_job(job->pid);
+	}
+}
+
+/**
+ * Function to get the exit status of a job that was already reported and
+ * taken out of the table. Like a job that is waited for, it is forgotten.
+ *
+ * Parameters:
+ * - pid: pid of the job
+ * - status: set to its exit status
+ *
+ * Returns: true if the job was reported, false if not.
+ */
+bool reported_status(pid_t pid, int *status) {
+	size_t i;
+	for (i = 0; i < JOB_STATUS_MAX; i++) {
+		if (pid > 0 && reported[i].pid == pid) {
+			*status = reported[i].status;
+			reported[i].pid = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Function to print the running background jobs, oldest first. Jobs that
+ * exited but were not reaped yet are left out; they are not reaped here.
+ *
+ * Parameters:
+ * - out: stream to print to
+ *
+ * Returns: void
+ */
+void print_jobs(FILE *out) {
+	size_t i;
+	for (i = 0; i < job_end; i++) {
+		siginfo_t info;
+		if (job_table[i].pid == 0 || job_table[i].done) {
+			continue;
+		}
+		info.si_pid = 0;
+		if (waitid(P_PID, job_table[i].pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0) {
+			continue;
+		}
+		fprintf(out, "%d %s", job_table[i].pid, job_table[i].cmd);
+	}
+}
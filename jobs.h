@@ -0,0 +1,52 @@
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Preprocessor Directives */
+#define JOB_TABLE_INIT_SZ 16
+#define JOB_EVENTS_MAX 64
+#define JOB_STATUS_MAX 256           /* Statuses of reported jobs kept for wait */
+
+/* Struct to store background job information; a slot with pid 0 is free.
+ * A job that finished stays in the table, done, until it is reported. */
+struct job {
+	pid_t pid;
+	int pidfd;
+	bool done;
+	int status;
+	char *cmd;
+};
+
+/* Struct to map a pid to the slot of its job */
+struct job_slot {
+	pid_t pid;
+	size_t slot;
+};
+
+/* Struct to store the exit status of a job taken out of the table */
+struct job_status {
+	pid_t pid;
+	int status;
+};
+
+/* Function Prototypes */
+void init_jobs(void);
+struct job *add_job(pid_t pid, char *cmd);
+struct job *find_job(pid_t pid);
+struct job *find_job_spec(const char *spec);
+size_t job_number(struct job *job);
+void delete_job(pid_t pid);
+void reap_jobs(void);
+bool wait_for_input(int fd);
+int wait_job(struct job *job);
+void wait_all_jobs(void);
+int wait_any_job(void);
+void notify_jobs(bool print);
+bool reported_status(pid_t pid, int *status);
+void print_jobs(FILE *out);
+
+#endif
@@ -0,0 +1,623 @@
+#include "lineedit.h"
+#include "debug.h"
+#include "history.h"
+#include "jobs.h"
+#include "prompt.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Keys that arrive as escape sequences, numbered past the byte values */
+enum edit_key {
+	KEY_UP = 256,
+	KEY_DOWN,
+	KEY_RIGHT,
+	KEY_LEFT,
+	KEY_HOME,
+	KEY_END,
+	KEY_DELETE,
+};
+
+/* What handling a key did to the line */
+enum edit_result {
+	EDIT_MORE,      /* Keep reading keys */
+	EDIT_DONE,      /* The line was entered */
+	EDIT_EOF,       /* Ctrl-D on an empty line */
+};
+
+/* Globals */
+struct line_editor editor;
+
+/**
+ * Function to check whether input from a file descriptor can be edited:
+ * it must be a terminal that understands escape sequences
+ *
+ * Parameters:
+ * - fd: file descriptor input comes from
+ *
+ * Returns: true if the line editor can be used.
+ */
+bool use_line_editor(int fd) {
+	struct termios t;
+	const char *term = getenv("TERM");
+	return isatty(fd) && tcgetattr(fd, &t) == 0 && term != NULL && strcmp(term, "dumb") != 0;
+}
+
+/**
+ * Function to write out the buffered terminal output
+ */
+static void out_flush(void) {
+	size_t off = 0;
+	while (off < editor.out_len) {
+		ssize_t n = write(STDOUT_FILENO, editor.out + off, editor.out_len - off);
+		if (n == -1 && errno != EINTR) {
+			break;
+		} else if (n > 0) {
+			off += n;
+		}
+	}
+	editor.out_len = 0;
+}
+
+/**
+ * Function to add to the terminal output
+ */
+static void out_put(const char *str, size_t len) {
+	while (len > 0) {
+		if (editor.out_len == EDIT_OUT_SZ) {
+			out_flush();
+		}
+		size_t n = EDIT_OUT_SZ - editor.out_len < len ? EDIT_OUT_SZ - editor.out_len : len;
+		memcpy(editor.out + editor.out_len, str, n);
+		editor.out_len += n;
+		str += n;
+		len -= n;
+	}
+}
+
+/**
+ * Function to get the number of columns some text takes up. Bytes that
+ * continue a UTF-8 character take none.
+ */
+static size_t columns(const char *str, size_t len) {
+	size_t i, cols = 0;
+	for (i = 0; i < len; i++) {
+		cols += ((unsigned char)str[i] & 0xc0) != 0x80;
+	}
+	return cols;
+}
+
+/**
+ * Function to move the terminal cursor left
+ */
+static void move_left(size_t cols) {
+	char seq[32];
+	if (cols > 0) {
+		out_put(seq, snprintf(seq, sizeof(seq), "\x1b[%zuD", cols));
+	}
+}
+
+/**
+ * Function to bring the screen up to date with a new view of the line.
+ * Only what changed since the last call is written: the cursor goes back
+ * to the first difference and the rest of the line is written from there.
+ * Cursor motion is relative, so the prompt before the line is never
+ * touched.
+ *
+ * Parameters:
+ * - view: what should be on screen after the prompt
+ * - len: length of the view
+ * - cursor: where the cursor should be in the view
+ *
+ * Returns: void
+ */
+static void render(const char *view, size_t len, size_t cursor) {
+	size_t d = 0;
+
+	while (d < len && d < editor.shown_len && view[d] == editor.shown[d]) {
+		d++;
+	}
+	/* Never start writing in the middle of a character */
+	while (d > 0 && ((d < len && ((unsigned char)view[d] & 0xc0) == 0x80)
+				|| (d < editor.shown_len && ((unsigned char)editor.shown[d] & 0xc0) == 0x80))) {
+		d--;
+	}
+
+	if (d < editor.shown_cur) {
+		move_left(columns(editor.shown + d, editor.shown_cur - d));
+	} else {
+		/* What is between the cursor and the difference is unchanged, so
+		 * writing it again just moves the cursor */
+		d = editor.shown_cur;
+	}
+	out_put(view + d, len - d);
+	if (len < editor.shown_len) {
+		out_put("\x1b[K", 3);
+	}
+	move_left(columns(view + cursor, len - cursor));
+
+	memcpy(editor.shown + d, view + d, len - d);
+	editor.shown_len = len;
+	editor.shown_cur = cursor;
+}
+
+/**
+ * Function to draw the line, or the reverse search in progress
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+static void redraw(void) {
+	struct history_entry entry;
+	char view[EDIT_VIEW_MAX];
+	size_t len = 0;
+
+	if (!editor.searching) {
+		render(editor.buf, editor.len, editor.pos);
+		return;
+	}
+
+	const char *prompt = editor.failed ? EDIT_FAILED_PROMPT : EDIT_SEARCH_PROMPT;
+	memcpy(view, prompt, strlen(prompt));
+	len += strlen(prompt);
+	memcpy(view + len, editor.query, editor.query_len);
+	len += editor.query_len;
+	memcpy(view + len, "': ", 3);
+	len += 3;
+	if (editor.match_id != -1 && get_entry(editor.match_id, &entry)) {
+		size_t n = entry.len < EDIT_LINE_MAX ? entry.len : EDIT_LINE_MAX;
+		memcpy(view + len, entry.line, n);
+		len += n;
+	}
+	render(view, len, len);
+}
+
+/**
+ * Function to forget what is on screen after the line was wiped, so the
+ * next redraw writes all of it
+ *
+ * Parameters:
+ * - prompt: true to print the prompt first
+ *
+ * Returns: void
+ */
+static void reset_screen(bool prompt) {
+	if (prompt) {
+		out_flush();
+		print_prompt();
+	}
+	editor.shown_len = editor.shown_cur = 0;
+}
+
+/**
+ * Function to replace the line being edited
+ */
+static void set_line(const char *line, size_t len) {
+	if (len > EDIT_LINE_MAX - 1) {
+		len = EDIT_LINE_MAX - 1;
+	}
+	memmove(editor.buf, line, len);
+	editor.len = editor.pos = len;
+}
+
+/**
+ * Function to get the offset of the character before the cursor
+ */
+static size_t prev_char(size_t pos) {
+	while (pos > 0 && ((unsigned char)editor.buf[--pos] & 0xc0) == 0x80) { }
+	return pos;
+}
+
+/**
+ * Function to get the offset of the character after the cursor
+ */
+static size_t next_char(size_t pos) {
+	if (pos < editor.len) {
+		pos++;
+	}
+	while (pos < editor.len && ((unsigned char)editor.buf[pos] & 0xc0) == 0x80) {
+		pos++;
+	}
+	return pos;
+}
+
+/**
+ * Function to delete part of the line, moving the cursor to where it was
+ */
+static void delete_range(size_t from, size_t to) {
+	memmove(editor.buf + from, editor.buf + to, editor.len - to);
+	editor.len -= to - from;
+	editor.pos = from;
+}
+
+/**
+ * Function to show an entry of the history while browsing it with Up and
+ * Down. The new line is kept aside until browsing returns to it.
+ *
+ * Parameters:
+ * - id: cmd id of the entry
+ *
+ * Returns: void
+ */
+static void show_entry(int id) {
+	struct history_entry entry;
+
+	if (!get_entry(id, &entry)) {
+		return;
+	}
+	if (editor.hist_id == -1) {
+		memcpy(editor.saved, editor.buf, editor.len);
+		editor.saved_len = editor.len;
+	}
+	editor.hist_id = id;
+	set_line(entry.line, entry.len);
+}
+
+/**
+ * Function to browse to an older (Up) or newer (Down) entry of the history
+ *
+ * Parameters:
+ * - older: true to go to the older entry
+ *
+ * Returns: void
+ */
+static void browse_history(bool older) {
+	int first, last;
+
+	if (!get_history_range(&first, &last)) {
+		return;
+	}
+	if (older) {
+		if (editor.hist_id == -1) {
+			show_entry(last);
+		} else if (editor.hist_id > first) {
+			show_entry(editor.hist_id - 1);
+		}
+	} else if (editor.hist_id != -1) {
+		if (editor.hist_id < last) {
+			show_entry(editor.hist_id + 1);
+		} else {
+			editor.hist_id = -1;
+			set_line(editor.saved, editor.saved_len);
+		}
+	}
+}
+
+/**
+ * Function to look for the query in the history, from an entry back
+ *
+ * Parameters:
+ * - before: newest cmd id to consider
+ *
+ * Returns: void
+ */
+static void search(int before) {
+	struct history_entry entry;
+
+	if (editor.query_len == 0) {
+		editor.match_id = -1;
+		editor.failed = false;
+	} else if (search_history(editor.query, editor.query_len, before, &entry)) {
+		editor.match_id = entry.cmd_id;
+		editor.failed = false;
+	} else {
+		editor.failed = true;
+	}
+}
+
+/**
+ * Function to leave reverse search
+ *
+ * Parameters:
+ * - accept: true to edit the entry that was found, false to go back to
+ *   the line as it was
+ *
+ * Returns: void
+ */
+static void end_search(bool accept) {
+	editor.searching = false;
+	if (accept && editor.match_id != -1) {
+		show_entry(editor.match_id);
+	}
+	out_put("\r\x1b[K", 4);
+	reset_screen(true);
+}
+
+static enum edit_result handle_key(int key);
+
+/**
+ * Function to handle a key during reverse search. Typing narrows the
+ * search, Ctrl-R finds the next older match, Ctrl-G and Ctrl-C cancel, and
+ * any other key takes the match and is handled as usual.
+ *
+ * Parameters:
+ * - key: key pressed
+ *
+ * Returns: what the key did to the line.
+ */
+static enum edit_result search_key(int key) {
+	switch (key) {
+	case CTRL('R'):
+		if (editor.match_id != -1) {
+			search(editor.match_id - 1);
+		}
+		return EDIT_MORE;
+	case CTRL('G'):
+	case CTRL('C'):
+		end_search(false);
+		return EDIT_MORE;
+	case CTRL('H'):
+	case 127:
+		while (editor.query_len > 0
+				&& ((unsigned char)editor.query[--editor.query_len] & 0xc0) == 0x80) { }
+		editor.match_id = -1;
+		search(INT_MAX);
+		return EDIT_MORE;
+	}
+
+	if (key >= ' ' && key < 256 && key != 127) {
+		if (editor.query_len < EDIT_LINE_MAX) {
+			editor.query[editor.query_len++] = key;
+			/* A longer query matches the current entry or an older one */
+			search(editor.match_id == -1 ? INT_MAX : editor.match_id);
+		}
+		return EDIT_MORE;
+	}
+
+	end_search(true);
+	return handle_key(key);
+}
+
+/**
+ * Function to handle a key
+ *
+ * Parameters:
+ * - key: byte read, or an edit_key
+ *
+ * Returns: what the key did to the line.
+ */
+static enum edit_result handle_key(int key) {
+	if (editor.searching) {
+		return search_key(key);
+	}
+
+	switch (key) {
+	case '\r':
+	case '\n':
+		return EDIT_DONE;
+	case CTRL('A'):
+	case KEY_HOME:
+		editor.pos = 0;
+		break;
+	case CTRL('E'):
+	case KEY_END:
+		editor.pos = editor.len;
+		break;
+	case CTRL('B'):
+	case KEY_LEFT:
+		editor.pos = prev_char(editor.pos);
+		break;
+	case CTRL('F'):
+	case KEY_RIGHT:
+		editor.pos = next_char(editor.pos);
+		break;
+	case CTRL('D'):
+		if (editor.len == 0) {
+			return EDIT_EOF;
+		}
+		/* Fall through */
+	case KEY_DELETE:
+		delete_range(editor.pos, next_char(editor.pos));
+		break;
+	case CTRL('H'):
+	case 127:
+		delete_range(prev_char(editor.pos), editor.pos);
+		break;
+	case CTRL('K'):
+		editor.len = editor.pos;
+		break;
+	case CTRL('U'):
+		delete_range(0, editor.pos);
+		break;
+	case CTRL('W'): {
+		size_t from = editor.pos;
+		while (from > 0 && editor.buf[from - 1] == ' ') {
+			from--;
+		}
+		while (from > 0 && editor.buf[from - 1] != ' ') {
+			from--;
+		}
+		delete_range(from, editor.pos);
+		break;
+	}
+	case CTRL('C'):
+		/* Throw the line away and start over */
+		editor.pos = editor.len;
+		redraw();
+		out_put("^C\n", 3);
+		editor.len = editor.pos = 0;
+		editor.hist_id = -1;
+		reset_screen(true);
+		break;
+	case CTRL('L'):
+		out_put("\x1b[H\x1b[2J", 7);
+		reset_screen(true);
+		break;
+	case CTRL('P'):
+	case KEY_UP:
+		browse_history(true);
+		break;
+	case CTRL('N'):
+	case KEY_DOWN:
+		browse_history(false);
+		break;
+	case CTRL('R'):
+		editor.searching = true;
+		editor.failed = false;
+		editor.query_len = 0;
+		editor.match_id = -1;
+		out_put("\r\x1b[K", 4);
+		reset_screen(false);
+		break;
+	default:
+		/* Other control characters are ignored */
+		if (key < ' ' || key >= 256 || editor.len == EDIT_LINE_MAX - 1) {
+			break;
+		}
+		memmove(editor.buf + editor.pos + 1, editor.buf + editor.pos, editor.len - editor.pos);
+		editor.buf[editor.pos++] = key;
+		editor.len++;
+		break;
+	}
+	return EDIT_MORE;
+}
+
+/**
+ * Function to turn the bytes of an escape sequence into a key
+ *
+ * Parameters:
+ * - c: byte read
+ *
+ * Returns: the key, or -1 if the sequence is not complete or not known.
+ */
+static int decode_escape(unsigned char c) {
+	switch (editor.esc) {
+	case ESC_START:
+		editor.esc = c == '[' || c == 'O' ? ESC_CSI : ESC_NONE;
+		editor.esc_param = 0;
+		return -1;
+	case ESC_CSI:
+		if (c >= '0' && c <= '9') {
+			editor.esc_param = editor.esc_param * 10 + c - '0';
+			return -1;
+		}
+		if (c == ';') {
+			return -1;
+		}
+		editor.esc = ESC_NONE;
+		switch (c) {
+		case 'A': return KEY_UP;
+		case 'B': return KEY_DOWN;
+		case 'C': return KEY_RIGHT;
+		case 'D': return KEY_LEFT;
+		case 'H': return KEY_HOME;
+		case 'F': return KEY_END;
+		case '~':
+			switch (editor.esc_param) {
+			case 1: case 7: return KEY_HOME;
+			case 4: case 8: return KEY_END;
+			case 3: return KEY_DELETE;
+			}
+		}
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Function to read a line from the terminal, letting the user edit it.
+ * The terminal is in raw mode while the line is read. Up and Down browse
+ * the history and Ctrl-R searches it. Background jobs are reaped while
+ * waiting for keys.
+ *
+ * Parameters:
+ * - line: buffer the line is copied to, grown if needed (like getline())
+ * - line_sz: size of the buffer
+ *
+ * Returns: length of the line, ending in a newline, or -1 at end of input.
+ */
+ssize_t edit_line(char **line, size_t *line_sz) {
+	enum edit_result result = EDIT_MORE;
+	struct termios raw;
+
+	if (tcgetattr(STDIN_FILENO, &editor.cooked) == -1) {
+		return getline(line, line_sz, stdin);
+	}
+	raw = editor.cooked;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+	editor.len = editor.pos = 0;
+	editor.shown_len = editor.shown_cur = 0;
+	editor.hist_id = -1;
+	editor.searching = false;
+	editor.esc = ESC_NONE;
+
+	while (result == EDIT_MORE) {
+		if (editor.in_pos == editor.in_len) {
+			/* Index the history for Ctrl-R until a key arrives */
+			struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+			while (!index_history(EDIT_INDEX_STEP) && poll(&pfd, 1, 0) == 0) { }
+			wait_for_input(STDIN_FILENO);
+			ssize_t n = read(STDIN_FILENO, editor.in, EDIT_READ_SZ);
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				result = EDIT_EOF;
+				break;
+			}
+			editor.in_len = n;
+			editor.in_pos = 0;
+		}
+
+		/* Keys typed or pasted together are drawn once */
+		while (result == EDIT_MORE && editor.in_pos < editor.in_len) {
+			unsigned char c = editor.in[editor.in_pos++];
+			int key = c;
+			if (editor.esc != ESC_NONE) {
+				key = decode_escape(c);
+			} else if (c == '\x1b') {
+				editor.esc = ESC_START;
+				key = -1;
+			}
+			if (key != -1) {
+				result = handle_key(key);
+			}
+		}
+		if (result == EDIT_MORE) {
+			redraw();
+			out_flush();
+		}
+	}
+
+	/* Leave the cursor after the line */
+	if (editor.searching) {
+		end_search(result == EDIT_DONE);
+	}
+	editor.pos = editor.len;
+	redraw();
+	out_put("\n", 1);
+	out_flush();
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &editor.cooked);
+
+	if (result == EDIT_EOF) {
+		return -1;
+	}
+
+	if (*line_sz < editor.len + 2) {
+		char *grown = realloc(*line, editor.len + 2);
+		if (grown == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		*line = grown;
+		*line_sz = editor.len + 2;
+	}
+	memcpy(*line, editor.buf, editor.len);
+	(*line)[editor.len] = '\n';
+	(*line)[editor.len + 1] = '\0';
+	LOG("Edited line: %.*s\n", (int)editor.len, editor.buf);
+	return editor.len + 1;
+}
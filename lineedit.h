@@ -0,0 +1,63 @@
+#ifndef _LINEEDIT_H_
+#define _LINEEDIT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <termios.h>
+
+/* Preprocessor Directives */
+#define EDIT_LINE_MAX 4096
+#define EDIT_READ_SZ 256
+#define EDIT_OUT_SZ 4096
+#define EDIT_INDEX_STEP 256          /* History entries indexed between checks for keys */
+#define EDIT_SEARCH_PROMPT "(reverse-i-search)`"
+#define EDIT_FAILED_PROMPT "(failed reverse-i-search)`"
+#define EDIT_VIEW_MAX (EDIT_LINE_MAX * 2 + sizeof(EDIT_FAILED_PROMPT) + 3)
+
+/* Where the editor is in an escape sequence */
+enum edit_esc_state {
+	ESC_NONE,
+	ESC_START,      /* Got ESC */
+	ESC_CSI,        /* Got ESC [ or ESC O, reading parameters */
+};
+
+/* Struct to store the state of the line editor. Everything is a fixed
+ * buffer, so handling a key never allocates. */
+struct line_editor {
+	char buf[EDIT_LINE_MAX];        /* Line being edited */
+	size_t len;
+	size_t pos;                     /* Cursor, as an offset into buf */
+
+	char shown[EDIT_VIEW_MAX];      /* What is on screen after the prompt */
+	size_t shown_len;
+	size_t shown_cur;               /* Where the cursor is in shown */
+
+	char saved[EDIT_LINE_MAX];      /* New line, kept while browsing history */
+	size_t saved_len;
+	int hist_id;                    /* Entry shown while browsing, or -1 */
+
+	bool searching;                 /* In reverse search (Ctrl-R) */
+	bool failed;                    /* The query has no (older) match */
+	char query[EDIT_LINE_MAX];
+	size_t query_len;
+	int match_id;                   /* Entry matching the query, or -1 */
+
+	enum edit_esc_state esc;
+	int esc_param;
+
+	char in[EDIT_READ_SZ];          /* Keys read but not handled yet */
+	size_t in_len;
+	size_t in_pos;
+
+	char out[EDIT_OUT_SZ];          /* Terminal output, written once per read */
+	size_t out_len;
+
+	struct termios cooked;
+};
+
+/* Function Prototypes */
+bool use_line_editor(int fd);
+ssize_t edit_line(char **line, size_t *line_sz);
+
+#endif
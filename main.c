@@ -0,0 +1,46 @@
+#include "exec.h"
+#include "history.h"
+#include "jobs.h"
+#include "prompt.h"
+#include "trace.h"
+#include "shell.h"
+
+int main(int argc, char *argv[]) {
+	/* Initialize history */
+	init_history();
+
+	/* Set up signal handlers. Builtins in pipelines write to pipes from
+	 * inside the shell, so a closed pipe must not kill it */
+	signal(SIGINT, sigint_handler);	
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Record events from the start; SIGUSR1 dumps them */
+	init_trace();
+
+	/* Watch stdin and background jobs together */
+	init_jobs();
+
+	/* "crash -c 'cmd'" and "crash script.sh" run without a prompt */
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "crash: -c: option requires an argument\n");
+			return 2;
+		}
+		run_script(argv[2], strlen(argv[2]));
+	} else if (argc > 1) {
+		if (run_script_file(argv[1]) == -1) {
+			return 127;
+		}
+	} else {
+		/* Initiate prompt */
+		interactive = isatty(STDIN_FILENO);
+		if (interactive) {
+			start_prompt();
+		}
+		run_stdin();
+	}
+	
+	/* Clean up memory (and stuff) */
+	arena_free(&line_arena);
+    return last_status;
+}
@@ -0,0 +1,176 @@
+#include "ngram.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Function to set up an empty index
+ *
+ * Parameters:
+ * - ni: index to set up
+ *
+ * Returns: void
+ */
+void ngram_init(struct ngram_index *ni) {
+	ni->lists = NULL;
+	ni->size = ni->count = 0;
+}
+
+/**
+ * Function to get the key of the n-gram at the start of a string
+ *
+ * Parameters:
+ * - str: at least n characters
+ * - n: length of the n-gram, 1 to NGRAM_MAX
+ *
+ * Returns: key of the n-gram, never 0.
+ */
+static uint32_t ngram_key(const char *str, size_t n) {
+	const unsigned char *s = (const unsigned char *)str;
+	uint32_t key = n;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		key = key << 8 | s[i];
+	}
+	return key;
+}
+
+/**
+ * Function to find the slot of an n-gram, or the empty slot it would go in
+ *
+ * Parameters:
+ * - ni: index to search, with at least one empty slot
+ * - key: key of the n-gram
+ *
+ * Returns: pointer to the matching or empty slot.
+ */
+static struct ngram_list *find_slot(struct ngram_index *ni, uint32_t key) {
+	size_t mask = ni->size - 1;
+	uint32_t hash = key * 2654435761U;
+	size_t i = (hash ^ hash >> 16) & mask;
+	while (ni->lists[i].key != 0 && ni->lists[i].key != key) {
+		i = (i + 1) & mask;
+	}
+	return &ni->lists[i];
+}
+
+/**
+ * Function to double the size of the table and rehash every list
+ *
+ * Parameters:
+ * - ni: index to grow
+ *
+ * Returns: false if memory cannot be allocated.
+ */
+static bool grow_table(struct ngram_index *ni) {
+	struct ngram_list *old = ni->lists;
+	size_t old_sz = ni->size, i;
+
+	size_t sz = old_sz == 0 ? NGRAM_INIT_SZ : old_sz * 2;
+	struct ngram_list *lists = calloc(sz, sizeof(struct ngram_list));
+	if (lists == NULL) {
+		perror("calloc");
+		return false;
+	}
+	ni->lists = lists;
+	ni->size = sz;
+	for (i = 0; i < old_sz; i++) {
+		if (old[i].key != 0) {
+			*find_slot(ni, old[i].key) = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+/**
+ * Function to add a line to the index. Lines must be added in the order of
+ * their ids.
+ *
+ * Parameters:
+ * - ni: index to add to
+ * - line: text of the line
+ * - len: length of the line
+ * - id: cmd id of the line
+ *
+ * Returns: void
+ */
+void ngram_insert(struct ngram_index *ni, const char *line, size_t len, int id) {
+	size_t i, n;
+
+	for (i = 0; i < len; i++) {
+		for (n = 1; n <= NGRAM_MAX && i + n <= len; n++) {
+			/* Keep the load factor at or below one half */
+			if ((ni->count + 1) * 2 > ni->size && !grow_table(ni)) {
+				return;
+			}
+
+			uint32_t key = ngram_key(line + i, n);
+			struct ngram_list *list = find_slot(ni, key);
+			if (list->key == 0) {
+				list->key = key;
+				ni->count++;
+			}
+
+			/* An n-gram that repeats within the line is listed once */
+			if (list->len > 0 && list->ids[list->len - 1] == id) {
+				continue;
+			}
+			/* Most of a full list may be lines dropped from the history;
+			 * move the rest to the front instead of growing it */
+			if (list->len == list->cap && list->start > list->len / 2) {
+				memmove(list->ids, list->ids + list->start, sizeof(int) * (list->len - list->start));
+				list->len -= list->start;
+				list->start = 0;
+			}
+			if (list->len == list->cap) {
+				size_t cap = list->cap == 0 ? NGRAM_LIST_INIT_SZ : list->cap * 2;
+				int *ids = realloc(list->ids, sizeof(int) * cap);
+				if (ids == NULL) {
+					perror("realloc");
+					return;
+				}
+				list->ids = ids;
+				list->cap = cap;
+			}
+			list->ids[list->len++] = id;
+		}
+	}
+}
+
+/**
+ * Function to find the lines that contain an n-gram
+ *
+ * Parameters:
+ * - ni: index to search
+ * - str: the n-gram
+ * - n: its length, 1 to NGRAM_MAX
+ *
+ * Returns: the list of lines, or NULL if no line contains the n-gram.
+ */
+struct ngram_list *ngram_find(struct ngram_index *ni, const char *str, size_t n) {
+	if (ni->size == 0) {
+		return NULL;
+	}
+	struct ngram_list *list = find_slot(ni, ngram_key(str, n));
+	return list->key == 0 ? NULL : list;
+}
+
+/**
+ * Function to free every list of the index, leaving it empty
+ *
+ * Parameters:
+ * - ni: index to free
+ *
+ * Returns: void
+ */
+void ngram_free(struct ngram_index *ni) {
+	size_t i;
+	for (i = 0; i < ni->size; i++) {
+		free(ni->lists[i].ids);
+	}
+	free(ni->lists);
+	ngram_init(ni);
+}
@@ -0,0 +1,38 @@
+#ifndef _NGRAM_H_
+#define _NGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Preprocessor Directives */
+#define NGRAM_MAX 3
+#define NGRAM_INIT_SZ 1024
+#define NGRAM_LIST_INIT_SZ 4
+
+/* Ids of the lines that contain an n-gram, oldest first. Lines are only
+ * ever added newest last, so the list stays sorted; ids before start were
+ * dropped from the history and are skipped until the list fills up. */
+struct ngram_list {
+	uint32_t key;       /* Length and characters of the n-gram; 0 if unused */
+	int *ids;
+	size_t start;
+	size_t len;
+	size_t cap;
+};
+
+/* Substring index over history lines: a hash table, open addressed with
+ * linear probing, from every string of one to NGRAM_MAX characters to the
+ * lines containing it */
+struct ngram_index {
+	struct ngram_list *lists;
+	size_t size;
+	size_t count;
+};
+
+/* Function Prototypes */
+void ngram_init(struct ngram_index *ni);
+void ngram_insert(struct ngram_index *ni, const char *line, size_t len, int id);
+struct ngram_list *ngram_find(struct ngram_index *ni, const char *str, size_t n);
+void ngram_free(struct ngram_index *ni);
+
+#endif
@@ -0,0 +1,533 @@
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include "debug.h"
+#include "exec.h"
+#include "jobs.h"
+#include "shell.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <poll.h>
+
+/* Struct to store the state of one run of parallel */
+struct par_run {
+	char **template;
+	bool replace;
+	bool keep_order;
+	int num_slots;
+	int null_fd;
+	FILE *out;
+	struct par_slot *slots;
+	struct par_result *results;
+	size_t results_cap;
+	size_t next_out;
+	size_t num_started;
+	struct par_failure *failures;
+	size_t num_failures;
+	size_t failures_cap;
+	bool out_of_memory;     /* No more lines are started once set */
+	struct arena args;
+};
+
+/**
+ * Function to print how parallel is used
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: exit status for a usage error.
+ */
+static int usage(void) {
+	fprintf(stderr, "crash: parallel: usage: parallel [-j slots] [-k] [-a file] command [args ...]\n");
+	return 2;
+}
+
+/**
+ * Function to build the arguments of the command for one input line. Every
+ * {} in the template is replaced by the line; without one, the line is
+ * added as the last argument, like xargs does.
+ *
+ * Parameters:
+ * - run: the run
+ * - line: input line
+ *
+ * Returns: argument vector, allocated from the run's arena.
+ */
+static char **build_args(struct par_run *run, char *line) {
+	size_t argc = 0, i;
+	while (run->template[argc] != NULL) {
+		argc++;
+	}
+
+	char **argv = arena_alloc(&run->args, sizeof(char *) * (argc + 2));
+	if (argv == NULL) {
+		return NULL;
+	}
+	if (!run->replace) {
+		memcpy(argv, run->template, sizeof(char *) * argc);
+		argv[argc] = line;
+		argv[argc + 1] = NULL;
+		return argv;
+	}
+
+	size_t line_len = strlen(line), rep_len = strlen(PARALLEL_REPLACE);
+	for (i = 0; i < argc; i++) {
+		const char *arg = run->template[i], *hit;
+		size_t count = 0;
+		for (hit = strstr(arg, PARALLEL_REPLACE); hit != NULL; hit = strstr(hit + rep_len, PARALLEL_REPLACE)) {
+			count++;
+		}
+		if (count == 0) {
+			argv[i] = run->template[i];
+			continue;
+		}
+
+		char *new_arg = arena_alloc(&run->args, strlen(arg) + count * line_len + 1), *end = new_arg;
+		if (new_arg == NULL) {
+			return NULL;
+		}
+		for (hit = strstr(arg, PARALLEL_REPLACE); hit != NULL; hit = strstr(arg, PARALLEL_REPLACE)) {
+			memcpy(end, arg, hit - arg);
+			end += hit - arg;
+			memcpy(end, line, line_len);
+			end += line_len;
+			arg = hit + rep_len;
+		}
+		strcpy(end, arg);
+		argv[i] = new_arg;
+	}
+	argv[argc] = NULL;
+	return argv;
+}
+
+/**
+ * Function to remember a command that failed, for the summary
+ *
+ * Parameters:
+ * - run: the run
+ * - seq: position of its line in the input
+ * - status: its exit status
+ * - line: its input line; the run takes ownership of it
+ *
+ * Returns: void
+ */
+static void add_failure(struct par_run *run, size_t seq, int status, char *line) {
+	if (run->num_failures == run->failures_cap) {
+		size_t cap = run->failures_cap == 0 ? 16 : run->failures_cap * 2;
+		struct par_failure *failures = realloc(run->failures, sizeof(struct par_failure) * cap);
+		if (failures == NULL) {
+			free(line);
+			return;
+		}
+		run->failures = failures;
+		run->failures_cap = cap;
+	}
+	run->failures[run->num_failures].seq = seq;
+	run->failures[run->num_failures].status = status;
+	run->failures[run->num_failures].line = line;
+	run->num_failures++;
+}
+
+/**
+ * Function to print the output of a finished command. In input order (-k),
+ * output is held until every command before it has been printed.
+ *
+ * Parameters:
+ * - run: the run
+ * - seq: position of the command's line in the input
+ * - buf: its output; the run takes ownership of it
+ * - len: length of the output
+ *
+ * Returns: void
+ */
+static void emit_output(struct par_run *run, size_t seq, char *buf, size_t len) {
+	if (!run->keep_order) {
+		fwrite(buf, 1, len, run->out);
+		fflush(run->out);
+		free(buf);
+		return;
+	}
+
+	run->results[seq].buf = buf;
+	run->results[seq].len = len;
+	run->results[seq].done = true;
+	while (run->next_out < run->num_started && run->results[run->next_out].done) {
+		struct par_result *result = &run->results[run->next_out++];
+		fwrite(result->buf, 1, result->len, run->out);
+		free(result->buf);
+		result->buf = NULL;
+	}
+	fflush(run->out);
+}
+
+/**
+ * Function to start the command for an input line in a free slot. Each
+ * command is a job of the shell, with its stdout going into a pipe that
+ * the run drains into the slot's buffer.
+ *
+ * Parameters:
+ * - run: the run
+ * - slot: free slot
+ * - line: input line; the run takes ownership of it
+ *
+ * Returns: true if the command started, false if it failed right away or
+ * memory ran out.
+ */
+static bool start_slot(struct par_run *run, struct par_slot *slot, char *line) {
+	size_t seq = run->num_started;
+	int fd[2], status = 127;
+	pid_t pid = -1;
+
+	if (line == NULL) {
+		perror("parallel");
+		run->out_of_memory = true;
+		return false;
+	}
+	if (run->keep_order && seq == run->results_cap) {
+		size_t cap = run->results_cap == 0 ? 64 : run->results_cap * 2;
+		struct par_result *results = realloc(run->results, sizeof(struct par_result) * cap);
+		if (results == NULL) {
+			perror("parallel");
+			run->out_of_memory = true;
+			free(line);
+			return false;
+		}
+		memset(results + run->results_cap, 0, sizeof(struct par_result) * (cap - run->results_cap));
+		run->results = results;
+		run->results_cap = cap;
+	}
+	run->num_started++;
+
+	char **argv = build_args(run, line);
+	if (argv != NULL && pipe2(fd, O_CLOEXEC) == 0) {
+		struct command_line cmd = { .tokens = argv, .stdout_pipe = true, .redirs = NULL, .num_redirs = 0 };
+		pid = start_command(&cmd, run->null_fd, fd[1], &status);
+		close(fd[1]);
+		if (pid == -1) {
+			close(fd[0]);
+		}
+	} else {
+		perror("parallel");
+	}
+
+	if (pid == -1) {
+		add_failure(run, seq, status, line);
+		emit_output(run, seq, NULL, 0);
+		arena_reset(&run->args);
+		return false;
+	}
+
+	struct job *job = add_job(pid, join_tokens(argv, "\n"));
+	arena_reset(&run->args);
+	LOG("parallel: started %d for line %zu\n", pid, seq);
+
+	slot->pid = pid;
+	slot->pidfd = job == NULL ? -1 : job->pidfd;
+	slot->out_fd = fd[0];
+	slot->exited = false;
+	slot->status = 0;
+	slot->seq = seq;
+	slot->line = line;
+	slot->buf = NULL;
+	slot->len = slot->cap = 0;
+	return true;
+}
+
+/**
+ * Function to read what a command printed into its slot's buffer. If the
+ * buffer cannot grow, the pipe is closed, so the command gets EPIPE instead
+ * of blocking.
+ *
+ * Parameters:
+ * - run: the run
+ * - slot: busy slot
+ *
+ * Returns: void
+ */
+static void read_slot(struct par_run *run, struct par_slot *slot) {
+	if (slot->cap - slot->len < PARALLEL_READ_SZ) {
+		size_t cap = slot->cap == 0 ? PARALLEL_READ_SZ : slot->cap * 2;
+		char *buf = realloc(slot->buf, cap);
+		if (buf == NULL) {
+			perror("parallel");
+			run->out_of_memory = true;
+			close(slot->out_fd);
+			slot->out_fd = -1;
+			return;
+		}
+		slot->buf = buf;
+		slot->cap = cap;
+	}
+
+	ssize_t n = read(slot->out_fd, slot->buf + slot->len, slot->cap - slot->len);
+	if (n > 0) {
+		slot->len += n;
+	} else if (n == 0 || errno != EINTR) {
+		close(slot->out_fd);
+		slot->out_fd = -1;
+	}
+}
+
+/**
+ * Function to collect a command's exit status
+ *
+ * Parameters:
+ * - slot: busy slot
+ * - block: true to wait for the command to exit
+ *
+ * Returns: void
+ */
+static void reap_slot(struct par_slot *slot, bool block) {
+	int wstatus;
+	pid_t pid;
+
+	while ((pid = waitpid(slot->pid, &wstatus, block ? 0 : WNOHANG)) == -1 && errno == EINTR) { }
+	if (pid == slot->pid) {
+		slot->exited = true;
+		slot->status = exit_status(wstatus);
+		trace_event(TRACE_WAIT, pid, slot->status, NULL);
+	} else if (pid == -1) {
+		/* Someone else reaped it; its status is lost */
+		slot->exited = true;
+		slot->status = 127;
+	}
+}
+
+/**
+ * Function to free a slot whose command exited and closed its output
+ *
+ * Parameters:
+ * - run: the run
+ * - slot: slot to free
+ *
+ * Returns: void
+ */
+static void finish_slot(struct par_run *run, struct par_slot *slot) {
+	LOG("parallel: %d exited with %d\n", slot->pid, slot->status);
+	delete_job(slot->pid);
+	if (slot->status != 0) {
+		add_failure(run, slot->seq, slot->status, slot->line);
+	} else {
+		free(slot->line);
+	}
+	emit_output(run, slot->seq, slot->buf, slot->len);
+	slot->pid = 0;
+}
+
+/**
+ * Function to compare failures by their position in the input
+ */
+static int compare_failures(const void *a, const void *b) {
+	const struct par_failure *fa = a, *fb = b;
+	return fa->seq < fb->seq ? -1 : fa->seq > fb->seq;
+}
+
+/**
+ * Function to run a command once per input line, like xargs -P. At most
+ * one command per slot runs at a time, and a slot takes the next line as
+ * soon as its command is done, so every slot stays busy until the input
+ * runs out. Each command's output is collected and printed in one piece,
+ * as commands finish or, with -k, in input order. Commands that fail are
+ * listed at the end.
+ *
+ * Parameters:
+ * - tokens: "parallel", options, then the command template
+ * - line: unused
+ * - out: stream to print the commands' output to
+ *
+ * Returns: 0 if every command succeeded, otherwise the number of failed
+ * commands (at most 101), 2 on a usage error, or at least 1 if memory ran
+ * out and some lines were not run.
+ */
+int builtin_parallel(char *tokens[], char *line, FILE *out) {
+	struct par_run run;
+	const char *file = NULL;
+	long num_slots = sysconf(_SC_NPROCESSORS_ONLN);
+	int i = 1, s;
+
+	memset(&run, 0, sizeof(run));
+	run.out = out;
+
+	for (; tokens[i] != NULL && tokens[i][0] == '-'; i++) {
+		if (strcmp(tokens[i], "--") == 0) {
+			i++;
+			break;
+		} else if (strcmp(tokens[i], "-k") == 0) {
+			run.keep_order = true;
+		} else if (strcmp(tokens[i], "-a") == 0 && tokens[i + 1] != NULL) {
+			file = tokens[++i];
+		} else if (strncmp(tokens[i], "-j", 2) == 0) {
+			const char *arg = tokens[i][2] != '\0' ? tokens[i] + 2 : tokens[++i];
+			char *end;
+			if (arg == NULL) {
+				return usage();
+			}
+			num_slots = strtol(arg, &end, 10);
+			if (*end != '\0' || num_slots <= 0) {
+				return usage();
+			}
+		} else {
+			return usage();
+		}
+	}
+	if (tokens[i] == NULL) {
+		return usage();
+	}
+	if (num_slots <= 0) {
+		num_slots = 1;
+	}
+
+	run.template = &tokens[i];
+	run.num_slots = num_slots;
+	for (; tokens[i] != NULL; i++) {
+		run.replace |= strstr(tokens[i], PARALLEL_REPLACE) != NULL;
+	}
+
+	/* Read lines through a stream of our own, so the shell's stays put */
+	FILE *in;
+	if (file != NULL) {
+		in = fopen(file, "re");
+	} else {
+		int fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+		in = fd == -1 ? NULL : fdopen(fd, "r");
+	}
+	if (in == NULL) {
+		fprintf(stderr, "crash: parallel: %s: %s\n", file != NULL ? file : "stdin", strerror(errno));
+		return 1;
+	}
+
+	/* Commands read nothing; the input is for parallel */
+	run.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	run.slots = calloc(run.num_slots, sizeof(struct par_slot));
+	struct pollfd *fds = calloc(run.num_slots * 2, sizeof(struct pollfd));
+	int *owner = calloc(run.num_slots * 2, sizeof(int));
+	if (run.slots == NULL || fds == NULL || owner == NULL) {
+		perror("parallel");
+		free(run.slots);
+		free(fds);
+		free(owner);
+		if (run.null_fd != -1) {
+			close(run.null_fd);
+		}
+		fclose(in);
+		return 1;
+	}
+
+	char *input = NULL;
+	size_t input_sz = 0;
+	int running = 0;
+	bool input_done = false;
+
+	while (true) {
+		/* Hand lines to free slots; once memory ran out, the commands
+		 * that run are left to finish and no more are started */
+		for (s = 0; s < run.num_slots && !input_done && !run.out_of_memory; s++) {
+			if (run.slots[s].pid != 0) {
+				continue;
+			}
+			ssize_t len;
+			do {
+				len = getline(&input, &input_sz, in);
+				while (len > 0 && (input[len - 1] == '\n' || input[len - 1] == '\r')) {
+					input[--len] = '\0';
+				}
+			} while (len == 0);
+			if (len == -1) {
+				input_done = true;
+				break;
+			}
+			if (start_slot(&run, &run.slots[s], strdup(input))) {
+				running++;
+			} else if (!run.out_of_memory) {
+				/* Try the next line in the same slot */
+				s--;
+			}
+		}
+		if (running == 0) {
+			break;
+		}
+
+		/* Wait for output or an exit from any busy slot */
+		int num_fds = 0;
+		for (s = 0; s < run.num_slots; s++) {
+			struct par_slot *slot = &run.slots[s];
+			if (slot->pid == 0) {
+				continue;
+			}
+			if (slot->out_fd != -1) {
+				fds[num_fds].fd = slot->out_fd;
+				fds[num_fds].events = POLLIN;
+				owner[num_fds++] = s;
+			}
+			if (!slot->exited && slot->pidfd != -1) {
+				fds[num_fds].fd = slot->pidfd;
+				fds[num_fds].events = POLLIN;
+				owner[num_fds++] = s;
+			}
+		}
+		if (poll(fds, num_fds, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < num_fds; i++) {
+			struct par_slot *slot = &run.slots[owner[i]];
+			if (fds[i].revents == 0) {
+				continue;
+			}
+			if (fds[i].fd == slot->out_fd) {
+				read_slot(&run, slot);
+			} else if (fds[i].fd == slot->pidfd) {
+				reap_slot(slot, false);
+			}
+		}
+
+		/* A command is done once it exited and its output is drained.
+		 * Without a pidfd, its exit is only waited for after EOF. */
+		for (s = 0; s < run.num_slots; s++) {
+			struct par_slot *slot = &run.slots[s];
+			if (slot->pid == 0 || slot->out_fd != -1) {
+				continue;
+			}
+			if (!slot->exited && slot->pidfd == -1) {
+				reap_slot(slot, true);
+			}
+			if (slot->exited) {
+				finish_slot(&run, slot);
+				running--;
+			}
+		}
+	}
+
+	/* Summary of what failed, in input order */
+	if (run.num_failures > 0) {
+		size_t f;
+		qsort(run.failures, run.num_failures, sizeof(struct par_failure), compare_failures);
+		for (f = 0; f < run.num_failures; f++) {
+			fprintf(stderr, "crash: parallel: exit %d: %s\n", run.failures[f].status, run.failures[f].line);
+			free(run.failures[f].line);
+		}
+		fprintf(stderr, "crash: parallel: %zu of %zu commands failed\n", run.num_failures, run.num_started);
+	}
+
+	int ret = run.num_failures > PARALLEL_MAX_STATUS ? PARALLEL_MAX_STATUS : (int)run.num_failures;
+	if (run.out_of_memory && ret == 0) {
+		ret = 1;
+	}
+	free(input);
+	free(fds);
+	free(owner);
+	free(run.slots);
+	free(run.results);
+	free(run.failures);
+	arena_free(&run.args);
+	if (run.null_fd != -1) {
+		close(run.null_fd);
+	}
+	fclose(in);
+	return ret;
+}
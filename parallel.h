@@ -0,0 +1,44 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Preprocessor Directives */
+#define PARALLEL_REPLACE "{}"
+#define PARALLEL_READ_SZ 65536
+#define PARALLEL_MAX_STATUS 101
+
+/* Struct to store a command running in one of the worker slots */
+struct par_slot {
+	pid_t pid;        /* 0 if the slot is free */
+	int pidfd;        /* From the command's job, -1 if there is none */
+	int out_fd;       /* Read end of its stdout, -1 once at EOF */
+	bool exited;
+	int status;
+	size_t seq;       /* Position of its line in the input */
+	char *line;
+	char *buf;        /* Everything it printed so far */
+	size_t len;
+	size_t cap;
+};
+
+/* Struct to store the output of a finished command until it is printed */
+struct par_result {
+	char *buf;
+	size_t len;
+	bool done;
+};
+
+/* Struct to store a command that failed, for the summary */
+struct par_failure {
+	size_t seq;
+	int status;
+	char *line;
+};
+
+/* Function Prototypes */
+int builtin_parallel(char *tokens[], char *line, FILE *out);
+
+#endif
@@ -0,0 +1,295 @@
+#include "pathcache.h"
+#include "debug.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Globals */
+struct path_entry *path_table;
+size_t path_table_sz, path_table_count;
+
+/**
+ * Function to hash a command name (FNV-1a)
+ *
+ * Parameters:
+ * - name: command name to hash
+ *
+ * Returns: hash of the name.
+ */
+static size_t hash_name(const char *name) {
+	size_t hash = 14695981039346656037UL;
+	while (*name != '\0') {
+		hash ^= (unsigned char)*name++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/**
+ * Function to find the slot a command name lives in, or the empty slot it
+ * would be inserted into. The table is open addressed with linear probing.
+ *
+ * Parameters:
+ * - name: command name to find
+ *
+ * Returns: pointer to the matching or empty slot.
+ */
+static struct path_entry *find_slot(const char *name) {
+	size_t mask = path_table_sz - 1;
+	size_t i = hash_name(name) & mask;
+	while (path_table[i].name != NULL && strcmp(path_table[i].name, name) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &path_table[i];
+}
+
+/**
+ * Function to double the size of the table and rehash every entry. If
+ * memory cannot be allocated, the old table is kept.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: false if memory cannot be allocated.
+ */
+static bool grow_table(void) {
+	struct path_entry *old = path_table;
+	size_t old_sz = path_table_sz, i;
+
+	size_t sz = old_sz == 0 ? PATH_CACHE_INIT_SZ : old_sz * 2;
+	struct path_entry *table = calloc(sz, sizeof(struct path_entry));
+	if (table == NULL) {
+		perror("calloc");
+		return false;
+	}
+	path_table = table;
+	path_table_sz = sz;
+	for (i = 0; i < old_sz; i++) {
+		if (old[i].name != NULL) {
+			*find_slot(old[i].name) = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+/**
+ * Function to search PATH for an executable, the same way execvp() does
+ *
+ * Parameters:
+ * - name: command name to search for
+ *
+ * Returns: newly allocated absolute path, or NULL if not found.
+ */
+static char *resolve_path(const char *name) {
+	const char *dirs = getenv("PATH");
+	char candidate[PATH_MAX];
+	size_t name_len = strlen(name);
+
+	if (dirs == NULL) {
+		dirs = "/bin:/usr/bin";
+	}
+
+	while (true) {
+		size_t dir_len = strcspn(dirs, ":");
+		struct stat st;
+
+		/* An empty PATH entry means the current directory */
+		if (dir_len == 0) {
+			snprintf(candidate, sizeof(candidate), "./%s", name);
+		} else if (dir_len + name_len + 2 <= sizeof(candidate)) {
+			memcpy(candidate, dirs, dir_len);
+			candidate[dir_len] = '/';
+			memcpy(candidate + dir_len + 1, name, name_len + 1);
+		} else {
+			candidate[0] = '\0';
+		}
+
+		if (candidate[0] != '\0' && stat(candidate, &st) == 0
+				&& S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+			return strdup(candidate);
+		}
+
+		if (dirs[dir_len] == '\0') {
+			return NULL;
+		}
+		dirs += dir_len + 1;
+	}
+}
+
+/**
+ * Function to insert a resolved command into the table
+ *
+ * Parameters:
+ * - name: command name
+ * - path: absolute path it resolved to (ownership is taken on success)
+ *
+ * Returns: the new table entry, or NULL if memory cannot be allocated.
+ */
+static struct path_entry *insert_entry(const char *name, char *path) {
+	/* Keep the load factor at or below one half */
+	if ((path_table_count + 1) * 2 > path_table_sz && !grow_table()) {
+		return NULL;
+	}
+
+	struct path_entry *slot = find_slot(name);
+	slot->name = strdup(name);
+	if (slot->name == NULL) {
+		return NULL;
+	}
+	slot->path = path;
+	slot->hits = 0;
+	path_table_count++;
+	return slot;
+}
+
+/**
+ * Function to get the absolute path of a command. Names are resolved against
+ * PATH the first time they are seen and served from the table afterwards, so
+ * repeated commands go straight to execve without probing every directory.
+ *
+ * Parameters:
+ * - name: command name to look up
+ *
+ * Returns: path to execute, or NULL if the command is not on PATH. Names
+ * containing a '/' are returned unchanged. If the table cannot grow, the
+ * path is served uncached and stays valid until the next such lookup.
+ */
+const char *path_lookup(const char *name) {
+	static char *uncached;
+
+	if (strchr(name, '/') != NULL) {
+		return name;
+	}
+
+	if (path_table_sz > 0) {
+		struct path_entry *slot = find_slot(name);
+		if (slot->name != NULL) {
+			slot->hits++;
+			return slot->path;
+		}
+	}
+
+	char *path = resolve_path(name);
+	if (path == NULL) {
+		return NULL;
+	}
+	LOG("Hashed %s as %s\n", name, path);
+
+	struct path_entry *entry = insert_entry(name, path);
+	if (entry == NULL) {
+		free(uncached);
+		uncached = path;
+		return uncached;
+	}
+	entry->hits++;
+	return entry->path;
+}
+
+/**
+ * Function to resolve a command and remember it without running it
+ *
+ * Parameters:
+ * - name: command name to add
+ *
+ * Returns: true if the command was found on PATH, false if not.
+ */
+bool path_cache_add(const char *name) {
+	if (strchr(name, '/') != NULL) {
+		return true;
+	}
+
+	char *path = resolve_path(name);
+	if (path == NULL) {
+		return false;
+	}
+
+	/* Re-resolve names that are already present */
+	path_cache_remove(name);
+	if (insert_entry(name, path) == NULL) {
+		free(path);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Function to forget a single command, e.g. when its cached path went stale
+ *
+ * Parameters:
+ * - name: command name to remove
+ *
+ * Returns: void
+ */
+void path_cache_remove(const char *name) {
+	if (path_table_sz == 0) {
+		return;
+	}
+
+	struct path_entry *slot = find_slot(name);
+	if (slot->name == NULL) {
+		return;
+	}
+	free(slot->name);
+	free(slot->path);
+	slot->name = NULL;
+	path_table_count--;
+
+	/* Reinsert the rest of the probe run so lookups don't stop early */
+	size_t mask = path_table_sz - 1;
+	size_t i = ((size_t)(slot - path_table) + 1) & mask;
+	while (path_table[i].name != NULL) {
+		struct path_entry moved = path_table[i];
+		path_table[i].name = NULL;
+		*find_slot(moved.name) = moved;
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * Function to forget every remembered command, e.g. after PATH changes
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void path_cache_clear(void) {
+	size_t i;
+	for (i = 0; i < path_table_sz; i++) {
+		if (path_table[i].name != NULL) {
+			free(path_table[i].name);
+			free(path_table[i].path);
+			path_table[i].name = NULL;
+		}
+	}
+	path_table_count = 0;
+}
+
+/**
+ * Function to print remembered commands and how often each was used
+ *
+ * Parameters:
+ * - out: stream to print to
+ *
+ * Returns: void
+ */
+void print_path_cache(FILE *out) {
+	size_t i;
+
+	if (path_table_count == 0) {
+		fprintf(out, "hash: hash table empty\n");
+		return;
+	}
+
+	fprintf(out, "hits\tcommand\n");
+	for (i = 0; i < path_table_sz; i++) {
+		if (path_table[i].name != NULL) {
+			fprintf(out, "%4u\t%s\n", path_table[i].hits, path_table[i].path);
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef _PATHCACHE_H_
+#define _PATHCACHE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Preprocessor Directives */
+#define PATH_CACHE_INIT_SZ 64
+
+/* Struct to store a command name and where it was found on PATH */
+struct path_entry {
+	char *name;
+	char *path;
+	unsigned int hits;
+};
+
+/* Function Prototypes */
+const char *path_lookup(const char *name);
+bool path_cache_add(const char *name);
+void path_cache_remove(const char *name);
+void path_cache_clear(void);
+void print_path_cache(FILE *out);
+
+#endif
@@ -0,0 +1,279 @@
+#include "prompt.h"
+#include "debug.h"
+#include "shell.h"
+
+/* Globals */
+char username[BUF_SZ], hostname[HOST_NAME_MAX];
+struct prompt_seg *prompt_segs;
+size_t prompt_num_segs;
+char *prompt_text;
+
+/* The last prompt printed, after a newline, so the SIGINT handler can print
+ * it again with one write(); only valid while prompt_ready is set */
+char prompt_buf[PATH_MAX + 1];
+size_t prompt_len;
+volatile sig_atomic_t prompt_ready;
+
+/* The cached working directory: how long it is, how much of it is the home
+ * directory (0 if it is not under it) and where its last component starts */
+size_t cwd_len, cwd_home_len, cwd_base;
+
+/**
+ * Function to initiate prompt and cache information
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void start_prompt(void) {
+	/* Get information from getpwuid */
+	struct passwd *passwd;
+	passwd = getpwuid(getuid());
+
+	/* Get username and home directory */
+	if (passwd != NULL) {
+		snprintf(username, sizeof(username), "%s", passwd->pw_name);
+		snprintf(home_dir, PATH_MAX, "%s", passwd->pw_dir);
+	}
+
+	/* Get hostname */
+	hostname[HOST_NAME_MAX - 1] = '\0';
+	gethostname(hostname, HOST_NAME_MAX - 1);
+
+	/* Get current working directory; from now on only cd changes it */
+	update_cwd();
+
+	const char *format = getenv(PROMPT_VAR);
+	if (format == NULL || compile_prompt(format) == -1) {
+		compile_prompt(PROMPT_DEFAULT);
+	}
+}
+
+/**
+ * Function to add text to the compiled prompt, extending the last segment
+ * when it is text too
+ *
+ * Parameters:
+ * - text_len: length of prompt_text so far; updated
+ * - str: text to add
+ * - len: length of the text
+ *
+ * Returns: void
+ */
+static void add_text(size_t *text_len, const char *str, size_t len) {
+	struct prompt_seg *last = prompt_num_segs > 0 ? &prompt_segs[prompt_num_segs - 1] : NULL;
+
+	memcpy(prompt_text + *text_len, str, len);
+	if (last != NULL && last->type == PROMPT_TEXT) {
+		last->len += len;
+	} else {
+		prompt_segs[prompt_num_segs].type = PROMPT_TEXT;
+		prompt_segs[prompt_num_segs].text = prompt_text + *text_len;
+		prompt_segs[prompt_num_segs].len = len;
+		prompt_num_segs++;
+	}
+	*text_len += len;
+}
+
+/**
+ * Function to compile a prompt format into segments, so printing a prompt
+ * only fills in what changes. The format is like PS1: \# is the command
+ * number, \u the user, \h the host, \w the working directory with the home
+ * directory as ~, \W its last component, \$ '#' for root and '$' otherwise,
+ * \n a newline and \\ a backslash. Anything else is printed as it is.
+ *
+ * Parameters:
+ * - format: prompt format
+ *
+ * Returns: 0 on success, -1 if memory cannot be allocated (the previous
+ * prompt is kept).
+ */
+int compile_prompt(const char *format) {
+	size_t fmt_len = strlen(format), text_len = 0;
+	size_t name_len = strlen(username) + strlen(hostname);
+	const char *p;
+
+	/* An escape may expand to a name, and each character is one segment
+	 * at most */
+	char *text = malloc(fmt_len * (name_len + 1) + 1);
+	struct prompt_seg *segs = malloc(sizeof(struct prompt_seg) * (fmt_len + 1));
+	if (text == NULL || segs == NULL) {
+		perror("prompt");
+		free(text);
+		free(segs);
+		return -1;
+	}
+	free(prompt_text);
+	free(prompt_segs);
+	prompt_text = text;
+	prompt_segs = segs;
+	prompt_num_segs = 0;
+
+	for (p = format; *p != '\0'; p++) {
+		if (*p != '\\' || p[1] == '\0') {
+			add_text(&text_len, p, 1);
+			continue;
+		}
+		switch (*++p) {
+		case '#':
+			prompt_segs[prompt_num_segs++].type = PROMPT_CMD_ID;
+			break;
+		case 'w':
+			prompt_segs[prompt_num_segs++].type = PROMPT_CWD;
+			break;
+		case 'W':
+			prompt_segs[prompt_num_segs++].type = PROMPT_CWD_BASE;
+			break;
+		case 'u':
+			add_text(&text_len, username, strlen(username));
+			break;
+		case 'h':
+			add_text(&text_len, hostname, strlen(hostname));
+			break;
+		case '$':
+			add_text(&text_len, geteuid() == 0 ? "#" : "$", 1);
+			break;
+		case 'n':
+			add_text(&text_len, "\n", 1);
+			break;
+		case '\\':
+			add_text(&text_len, "\\", 1);
+			break;
+		default:
+			add_text(&text_len, p - 1, 2);
+			break;
+		}
+	}
+	LOG("Compiled prompt '%s' into %zu segments\n", format, prompt_num_segs);
+	return 0;
+}
+
+/**
+ * Function to refresh the cached working directory. The prompt never calls
+ * getcwd() itself, so this runs when the shell starts and after cd.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void update_cwd(void) {
+	size_t home_len = strlen(home_dir);
+
+	if (getcwd(cwd, PATH_MAX) == NULL) {
+		cwd[0] = '\0';
+	}
+	cwd_len = strlen(cwd);
+
+	/* The home directory is only replaced when it is a whole component */
+	cwd_home_len = home_len > 0 && strncmp(cwd, home_dir, home_len) == 0
+			&& (cwd[home_len] == '/' || cwd[home_len] == '\0') ? home_len : 0;
+
+	char *slash = strrchr(cwd, '/');
+	cwd_base = slash == NULL || slash[1] == '\0' ? 0 : slash + 1 - cwd;
+}
+
+/**
+ * Function to append to the prompt being built, cutting it short if it
+ * does not fit
+ */
+static void put(char *buf, size_t *len, const char *str, size_t n) {
+	if (n > PATH_MAX - *len) {
+		n = PATH_MAX - *len;
+	}
+	memcpy(buf + *len, str, n);
+	*len += n;
+}
+
+/**
+ * Function to write a buffer to stdout, retrying short writes. Only write()
+ * is used, so it is async-signal-safe.
+ */
+static void write_all(const char *buf, size_t len) {
+	size_t i;
+	for (i = 0; i < len; ) {
+		ssize_t n = write(STDOUT_FILENO, buf + i, len - i);
+		if (n == -1 && errno != EINTR) {
+			break;
+		} else if (n > 0) {
+			i += n;
+		}
+	}
+}
+
+/**
+ * Function to print the prompt. It is built in one buffer and written with
+ * a single write(). The buffer is kept for redraw_prompt().
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void print_prompt(void) {
+	char *buf = prompt_buf + 1, num[16];
+	size_t len = 0, i;
+
+	/* The SIGINT handler must not print a prompt being built */
+	prompt_ready = 0;
+	prompt_buf[0] = '\n';
+
+	for (i = 0; i < prompt_num_segs; i++) {
+		const struct prompt_seg *seg = &prompt_segs[i];
+		switch (seg->type) {
+		case PROMPT_TEXT:
+			put(buf, &len, seg->text, seg->len);
+			break;
+		case PROMPT_CMD_ID: {
+			/* Digits are written backwards from the end of num */
+			char *d = num + sizeof(num);
+			unsigned int id = cmd_id;
+			do {
+				*--d = '0' + id % 10;
+				id /= 10;
+			} while (id > 0);
+			put(buf, &len, d, num + sizeof(num) - d);
+			break;
+		}
+		case PROMPT_CWD:
+			if (cwd_home_len > 0) {
+				put(buf, &len, "~", 1);
+			}
+			put(buf, &len, cwd + cwd_home_len, cwd_len - cwd_home_len);
+			break;
+		case PROMPT_CWD_BASE:
+			if (cwd_home_len > 0 && cwd_home_len == cwd_len) {
+				put(buf, &len, "~", 1);
+			} else {
+				put(buf, &len, cwd + cwd_base, cwd_len - cwd_base);
+			}
+			break;
+		}
+	}
+
+	prompt_len = len;
+	prompt_ready = 1;
+
+	/* Output of the last command must come first */
+	fflush(stdout);
+	write_all(buf, len);
+}
+
+/**
+ * Function to move to a new line after ^C, printing the last prompt again
+ * when the shell is waiting for a command. Only write() is used, so it is
+ * safe to call from the SIGINT handler.
+ *
+ * Parameters:
+ * - prompt: true to print the prompt after the newline
+ *
+ * Returns: void
+ */
+void redraw_prompt(bool prompt) {
+	if (prompt && prompt_ready) {
+		write_all(prompt_buf, prompt_len + 1);
+	} else {
+		write_all("\n", 1);
+	}
+}
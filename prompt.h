@@ -0,0 +1,34 @@
+#ifndef _PROMPT_H_
+#define _PROMPT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Preprocessor Directives */
+#define PROMPT_VAR "PS1"
+#define PROMPT_DEFAULT "--[\\#|\\u@\\h:\\w]--$ "
+
+/* Kinds of prompt segments; everything that does not change between
+ * prompts is folded into text segments when the format is compiled */
+enum prompt_seg_type {
+	PROMPT_TEXT,        /* Literal text, user and host names */
+	PROMPT_CMD_ID,      /* \# */
+	PROMPT_CWD,         /* \w, with the home directory shown as ~ */
+	PROMPT_CWD_BASE,    /* \W */
+};
+
+/* Struct to store a segment of a compiled prompt */
+struct prompt_seg {
+	enum prompt_seg_type type;
+	const char *text;   /* PROMPT_TEXT only */
+	size_t len;
+};
+
+/* Function Prototypes */
+void start_prompt(void);
+int compile_prompt(const char *format);
+void update_cwd(void);
+void print_prompt(void);
+void redraw_prompt(bool prompt);
+
+#endif
@@ -1,57 +1,171 @@
+#include "builtins.h"
+#include "cmdcache.h"
 #include "debug.h"
+#include "exec.h"
 #include "history.h"
+#include "jobs.h"
+#include "lineedit.h"
+#include "pathcache.h"
+#include "prompt.h"
+#include "stats.h"
 #include "tokenizer.h"
+#include "trace.h"
 #include "shell.h"
 
 /* Globals */
-int cmd_id = 0, jobs_i = 0;
-char username[BUF_SZ], hostname[HOST_NAME_MAX], home_dir[PATH_MAX], cwd[PATH_MAX];
-struct job *jobs[10];
-bool command_executing;
-
-/* Signal handler to handle ^C */
+struct arena line_arena;
+int cmd_id = 0;
+/* cmd id of the line being run; history recall only looks at older entries */
+int line_id = 0;
+char home_dir[PATH_MAX], cwd[PATH_MAX];
+bool command_executing, interactive, exec_final;
+
+/* Signal handler to handle ^C; stdio is not async-signal-safe, so the
+ * prompt is written from the copy kept by print_prompt() */
 void sigint_handler(int signo) {
-	if (isatty(STDIN_FILENO)) {
-		printf("\n");
-		if (!command_executing) {
-			print_prompt();
-		}
-		fflush(stdout);
+	if (interactive) {
+		int saved_errno = errno;
+		redraw_prompt(!command_executing);
+		errno = saved_errno;
 	}
 }
 
-/* Signal handler to handle child process exiting */
-void sigchild_handler(int signo) {
-	/* Child pid */
-	pid_t kidpid;
-	int status;
-	while ((kidpid = waitpid(-1, &status, WNOHANG)) > 0) {
-		/* Terminate child process with pid */
-		delete_job(kidpid);
+/**
+ * Function to run every line of a script held in memory. The newline after
+ * each line is overwritten in place, so lines are never copied.
+ *
+ * Parameters:
+ * - script: text of the script; modified
+ * - len: length of the script
+ *
+ * Returns: void
+ */
+void run_script(char *script, size_t len) {
+	char *p = script, *end = script + len;
+
+	/* The last line with a command on it may replace the shell */
+	char *last = end;
+	while (last > script && isspace((unsigned char)last[-1])) {
+		last--;
 	}
-	LOG("Child exited. Status: %d\n", status);
+
+	/* Scripts add nothing to the history */
+	line_id = cmd_id;
+
+	while (p < end) {
+		char *nl = memchr(p, '\n', end - p);
+		char *next = nl == NULL ? end : nl + 1;
+		char *line = p;
+
+		if (nl != NULL) {
+			*nl = '\0';
+		} else {
+			/* The buffer may end right after the last line */
+			line = arena_strndup(&line_arena, p, end - p);
+		}
+		exec_final = next >= last;
+
+		/* Reap background jobs that finished while the last command ran,
+		 * and take them out of the table */
+		reap_jobs();
+		notify_jobs(false);
+
+		LOG("-> Got line: %s\n", line);
+		trace_event(TRACE_LINE_READ, 0, next - p, NULL);
+		execute(line);
+		arena_reset(&line_arena);
+		p = next;
+	}
+	exec_final = false;
 }
 
-int main(void) {
-	/* Initialize history */
-	init_history();
+/**
+ * Function to run a script file. The file is mapped privately, so the
+ * whole script is read without a copy or a read() per line.
+ *
+ * Parameters:
+ * - path: path of the script
+ *
+ * Returns: 0 on success, -1 if the script cannot be read.
+ */
+int run_script_file(const char *path) {
+	struct stat st;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "crash: %s: %s\n", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
 
-	/* Initiate prompt */
-	start_prompt();
+	char *script = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (script == MAP_FAILED) {
+		fprintf(stderr, "crash: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
 
-	/* Set up signal handler */
-	signal(SIGINT, sigint_handler);	
+	run_script(script, st.st_size);
+	munmap(script, st.st_size);
+	return 0;
+}
+
+/**
+ * Function to read commands from stdin, one line at a time, prompting for
+ * each if stdin is a terminal
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void run_stdin(void) {
+	char *line = NULL;
+	size_t line_sz = 0;
+	bool editing = interactive && use_line_editor(STDIN_FILENO);
+
+	/* Interactive shells keep their history across sessions */
+	if (interactive) {
+		char *histfile = getenv(HISTFILE_VAR), path[PATH_MAX + sizeof(HISTFILE_NAME)];
+		if (histfile == NULL) {
+			snprintf(path, sizeof(path), "%s/%s", home_dir, HISTFILE_NAME);
+			histfile = path;
+		}
+		cmd_id = load_history(histfile);
+		atexit(close_history);
+	}
 
 	/* Loop forever, prompting the user for commands */
 	while (true) {
-		/* If fd refers to terminal, show prompt */
-		if (isatty(STDIN_FILENO)) {
+		/* Reap background jobs that finished while the last command ran */
+		reap_jobs();
+
+		/* If fd refers to terminal, report finished jobs and show prompt,
+		 * then wait for a line while reaping jobs as they finish. Scripts
+		 * take finished jobs out quietly; "wait <pid>" still gets their
+		 * status. */
+		notify_jobs(interactive);
+		if (interactive) {
 			print_prompt();
 		}
 
-		char *line = NULL, *history = NULL;
-		size_t line_sz = 0;
-		size_t sz = getline(&line, &line_sz, stdin);
+		/* Terminals get the line editor, which waits for keys itself */
+		ssize_t sz;
+		if (editing) {
+			sz = edit_line(&line, &line_sz);
+		} else {
+			if (interactive) {
+				wait_for_input(STDIN_FILENO);
+			}
+			sz = getline(&line, &line_sz, stdin);
+		}
 
 		/* Break if getline() fails */
 		if (sz == EOF) {
@@ -59,452 +173,296 @@ int main(void) {
 		}
 
 		LOG("-> Got line: %s", line);
+		trace_event(TRACE_LINE_READ, 0, sz, NULL);
 
-		/* Before tokenizing line, copy for history entry */
-		history = strdup(line); //dont forget to FREE
+		/* Add command to history before running it, so "history" lists itself.
+		 * Only stored lines use up a cmd id, which keeps ids consecutive. */
+		line_id = cmd_id;
+		if (add_history(cmd_id, strdup(line))) {
+			cmd_id++;
+		}
 
 		/* Execute command */
 		execute(line);
 
-		/* Add command to history */
-		add_history(cmd_id, history);
-
-		/* Increment cmd id after execution */
-		cmd_id++;
+		/* Everything allocated while running the line goes away at once */
+		arena_reset(&line_arena);
 	}
-	
-	/* Clean up memory (and stuff) */
-    return 0;
+
+	free(line);
 }
 
 /**
- *  Function to execute command.
+ * Function to expand a parsed word. Words without variables are used as
+ * they are, so only expansion runs again when a cached line is reused.
  *
- *	Parameters:
- *	- line: string to tokenize, then execute
+ * Parameters:
+ * - word: word to expand
  *
- *	Returns: void
+ * Returns: the expanded word, allocated from the line arena.
  */
-void execute(char *line) {
-	char *tokens[ARG_MAX], *next_tok = strdup(line), *curr_tok;
-	int i = 0, background = 0;
-
-	/* Tokenize */
-    while (((curr_tok = next_token(&next_tok, " \'\"\t\r\n")) != NULL) && i < ARG_MAX) {
-		/* Allow comments with # */
-		if (curr_tok[0] == '#') {
-			break;
-		}
-		/* & acts as a command separator, run what came before that in background */
-		if (curr_tok[0] == '&') {
-			background = 1;
-			break;
-		}
-		
-		/* Expand environment variables */
-		char *new_str = expand_var(curr_tok);
+static char *expand_word(struct parsed_word *word) {
+	if (word->flags & (TOK_EXPAND | TOK_LITERAL)) {
+		char *new_str = expand_var(&line_arena, word->text, word->len);
 		if (new_str != NULL) {
-			while (strstr(new_str, "$") != NULL) {
-				new_str = expand_var(new_str);
-			}
-			curr_tok = new_str;
-		}
-
-		tokens[i++] = curr_tok;
-	}
-	tokens[i] = (char *) NULL;
-	
-	/* Check if argument is a built in command first */
-	if (builtin_cmd(tokens, line)) {
-		return;
-	}
-
-	/* Implement piping */
-	struct command_line cmds[i];
-	cmds[0].tokens = tokens;
-	cmds[0].stdout_pipe = true;
-	cmds[0].stdout_file = NULL;
-	/* Keep track of command index and current token */
-	int cmds_i = 1, curr_tok_i;
-	/* Traverse tokens */
-	for (curr_tok_i = 0; curr_tok_i < i; curr_tok_i++) {
-		/* Find pipe */
-		if (strcmp(tokens[curr_tok_i], "|") == 0) {
-			/* Set pipe to null so tokenizer knows where to split */
-			tokens[curr_tok_i] = NULL;
-			/* Set up command line struct */
-			cmds[cmds_i].tokens = &tokens[curr_tok_i + 1];
-			cmds[cmds_i].stdout_pipe = true;
-			cmds[cmds_i].stdout_file = NULL;
-			cmds_i++;
-		 } 
-		 /* Find > operator */
-		 else if (strcmp(tokens[curr_tok_i], ">") == 0) {
-		 	/* Go to last command to edit */
-			cmds_i--;
-			/* Set > operator to null so tokenizer knows where to split */
-			tokens[curr_tok_i] = NULL;
-			/* Change stdout)file to token after > operator */
-			cmds[cmds_i].stdout_file = tokens[curr_tok_i + 1];
-			cmds_i++;
-			break;
-		 }
-	}
-	/* Last command so set stdout_pipe = false */
-	cmds[cmds_i - 1].stdout_pipe = false;
-	
-	command_executing = true;
-	pid_t pid = fork();
-	if (pid == 0) {
-		/* Child */
-		/* Execute pipeline */
-		int ret = execute_pipeline(cmds);
-		fclose(stdin);
-		if (ret == -1) {
-			/* Error, exit */
-			exit(0);
-		}
-	} else if (pid == -1) {
-		perror("fork");	
-	} else {
-		/* Parent */
-		/* If there are background jobs, add them to jobs list */
-		if (background) {
-			background_cmd(tokens, pid);
-		} else {
-			int status;
-			waitpid(pid, &status, 0);
-			command_executing = false;
-			LOG("Child exited. Status: %d\n", status);
+			return new_str;
 		}
 	}
+	return word->text;
 }
 
-/* 
- * Function to execute command through pipeline.
+/**
+ * Function to build a pipeline of a parsed line. The commands, their
+ * argument vectors and their redirections all come from the line arena, so
+ * the shell's stack stays small however long the line is, including when
+ * recalling history runs execute() again.
  *
  * Parameters:
- * - cmds: command structs to run in pipe
- * 			
- * Returns: int, 1 if successful, 0 if unsuccessful.
+ * - pl: parsed line
+ * - pp: pipeline of the line to build
+ *
+ * Returns: the pipeline, or NULL if memory cannot be allocated.
  */
-int execute_pipeline(struct command_line *cmds) {
-	if (cmds->stdout_pipe == false) {
-		if (cmds->stdout_file != NULL) {
-			/**
-			 * For a list of flags, see man 2 open:
-			 *
-			 * - O_RDWR - open for reading and writing (we could get by with O_WRONLY
-			 *            instead)
-			 * - O_CREAT - create file if it does not exist
-			 * - O_TRUNC - truncate size to 0
-			 */
-			int open_flags = O_RDWR | O_CREAT | O_TRUNC;
-			int open_perms = 0644;
-
-			/* Create file descriptor with perms */
-			int fd = open(cmds->stdout_file, open_flags, open_perms);
-			/* If failed, print error */
-			if (fd == -1) {
-				perror("open");
-				return 0;
-			}
-			/* If dup2 to stdout fails, print error */
-			if (dup2(fd, fileno(stdout)) == -1) {
-				perror("dup2");
-				return 0;
-			}	
-		}
-		/* If no error, execvp tokens */
-		execvp(cmds->tokens[0], cmds->tokens);
-		return 1;
+static struct pipeline *build_pipeline(struct parsed_line *pl, struct parsed_pipeline *pp) {
+	struct parsed_stage *first = &pl->stages[pp->first_stage];
+	struct parsed_stage *last = &first[pp->num_stages - 1];
+	size_t num_words = last->first_word + last->num_words - first->first_word;
+	size_t num_redirs = last->first_redir + last->num_redirs - first->first_redir;
+
+	struct pipeline *p = arena_alloc(&line_arena, sizeof(struct pipeline));
+	struct command_line *cmds = arena_alloc(&line_arena, sizeof(struct command_line) * pp->num_stages);
+	char **tokens = arena_alloc(&line_arena, sizeof(char *) * (num_words + pp->num_stages));
+	struct redirect *redirs = arena_alloc(&line_arena, sizeof(struct redirect) * (num_redirs + 1));
+	size_t w;
+	int s;
+
+	if (p == NULL || cmds == NULL || tokens == NULL || redirs == NULL) {
+		return NULL;
 	}
 
-   /* Creates a pipe. */
-    int fd[2];
-    if (pipe(fd) == -1) {
-        perror("pipe");
-        return 0;
-    }
-
-    pid_t pid = fork();
-    if (pid == 0) {
-        /* Child */
-		dup2(fd[1], fileno(stdout));
-        close(fd[0]);
-		execvp(cmds->tokens[0], cmds->tokens);
-    } else {
-        /* Parent */
-		dup2(fd[0], fileno(stdin));
-		close(fd[1]);
-		execute_pipeline(cmds + 1);
-    } 
-	return 0;
-}
+	for (s = 0; s < pp->num_stages; s++) {
+		struct parsed_stage *stage = &first[s];
 
-/**
- * Function to allow the shell to support built in functions that execvp() cannot
- *
- * Parameters:
- * - tokens: tokens to execute
- * - line: line to add to history
- * 			
- * Returns: true if successful, false if unsuccessful.
- */
-bool builtin_cmd(char *tokens[], char *line) {
-	/* If no tokens, return null */
-	if (tokens[0] == NULL) {
-		return false;
-	}
-	/* "cd" */
-	if (strcmp(tokens[0], "cd") == 0) {
-		/* Check if second argument is given */
-		if (tokens[1] != NULL) {
-			/* If given, check if directory exists */
-			if (chdir(tokens[1]) == 0) {
-				LOG("Switched directories from %s to %s successfully\n", cwd, tokens[1]);
-			} else {
-				LOG("Could not switch directories from %s to %s\n", cwd, tokens[1]);
-			}
-		/* If no second argument, switch to home directory */
-		} else {
-			chdir(home_dir);
-			LOG("Swtiched directories from %s to %s successfully\n", cwd, home_dir);
+		cmds[s].tokens = tokens;
+		cmds[s].stdout_pipe = s < pp->num_stages - 1;
+		cmds[s].redirs = redirs;
+		cmds[s].num_redirs = stage->num_redirs;
+		for (w = 0; w < stage->num_words; w++) {
+			*tokens++ = expand_word(&pl->words[stage->first_word + w]);
 		}
-		return true;
-	}
-	/* "history" */
-	if (strcmp(tokens[0], "history") == 0) {
-		/* Add 'history' to history */
-		add_history(cmd_id, line);
-		print_history();
-		return true;
-	}
-	/* "!!" */
-	if (strcmp(tokens[0], "!!") == 0) {
-		struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
-		temp = get_last_entry();
-		/* Check if last entry exists */
-		if (temp != NULL) {
-			execute(temp->line);
-		} else {
-			perror("No last entry found\n");
+		/* End the current command's tokens */
+		*tokens++ = (char *) NULL;
+
+		for (w = 0; w < stage->num_redirs; w++) {
+			struct parsed_redir *redir = &pl->redirs[stage->first_redir + w];
+			redirs->type = redir->type;
+			redirs->path = expand_word(&redir->path);
+			redirs++;
 		}
-		return true;
 	}
-	/* "!" */
-	else if (startsWith("!", line)) {
-		/* Get line without ! */
-		line = next_token(&line, "!");
-
-		/* Check if argument is cmd id */
-		int cmd_id = atoi(line);
-		if (cmd_id > 0) {
-			struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
-			temp = get_entry(cmd_id);
-			if (temp != NULL) {
-				execute(temp->line);
-			}
-		}
 
-		/* If argument is line */
-		else {
-			int found = 1;
-			struct history_entry *temp = (struct history_entry*)malloc(sizeof(struct history_entry));
-			temp = get_entry_by_line(line, &found);
-			/* If found latest command */
-			if (found == 0) {
-				execute(temp->line);
-			} else {
-				perror("No last entry found\n");
-			}
-		}
-		return true;
-	}
-	/* "setenv" */
-	if (strcmp(tokens[0], "setenv") == 0) {
-		/* Check if there are enough commands, then setenv */
-		if (tokens[2] != NULL) {
-			setenv(tokens[1], tokens[2], true);
-		}
-	}
-	/* "jobs" */
-	if (strcmp(tokens[0], "jobs") == 0) {
-		/* Iterate list of jobs and print */
-		int i;
-		for (i = 0; i < jobs_i; ++i) {
-			printf("%d %s", jobs[i]->pid, jobs[i]->cmd);
-		}
-		return true;
-	}
-	/* "exit" */
-	if (strcmp(tokens[0], "exit") == 0) {
-		exit(0);
-		return true;
-	}
-	return false;
+	p->cmds = cmds;
+	p->num_cmds = pp->num_stages;
+	p->background = pp->background;
+	p->timed = pp->timed;
+	return p;
 }
 
 /**
- * Function to allow the shell to support background jobs
+ * Function to run one pipeline of a line
  *
  * Parameters:
- * - tokens: tokens to execvp in the background
- * - pid: pid to add to jobs
+ * - p: pipeline to run
+ * - line: line to pass to builtins, or NULL
+ * - final: true if nothing in the line runs after it
  *
  * Returns: void
  */
-void background_cmd(char *tokens[], pid_t pid) {
-	/* Set up signal handler */
-	signal(SIGCHLD, sigchild_handler);
-	
-	/* Create new job */
-	struct job *new_job = (struct job*)malloc(sizeof(struct job));
-	new_job->pid = pid;
-	new_job->cmd = (char *)NULL;
-
-	/* Tokenize line of new job and add */
-	int i = 0;
-	char *cmd = NULL;
-	while (tokens[i] != NULL) {
-		if (i == 0) {
-			cmd = strdup(tokens[i]);
-		} else {
-			strcat(cmd, tokens[i]);
-		}
-		i++;
-		strcat(cmd, " ");
+static void run_pipeline(struct pipeline *p, char *line, bool final) {
+	struct usage usage;
+	struct rusage before, after;
+	bool timed = p->timed && !p->background;
+
+	/* Time what the shell does as well as what its children do */
+	if (timed) {
+		memset(&usage, 0, sizeof(usage));
+		usage.wall_ns = now_ns();
+		thread_rusage(&before);
 	}
-	
-	/* If no line, do not add to list and return */
-	if (cmd == NULL) {
-		return;
+
+	/* Check if argument is a built in command first */
+	if (builtin_cmd(p, line)) {
+		/* Keep builtin output ordered with output from later children */
+		fflush(stdout);
+	} else if (exec_final && final && !timed && p->num_cmds == 1 && !p->background) {
+		/* The last command of a script or -c string replaces the shell */
+		exec_final = false;
+		last_status = exec_command(&p->cmds[0]);
+	} else {
+		command_executing = true;
+		execute_pipeline(p, timed ? &usage : NULL);
+		command_executing = false;
 	}
 
-	/* Else, complete jobs then add to jobs list*/
-	strcat(cmd, "&\n");
-	new_job->cmd = cmd;
-	jobs[jobs_i] = (struct job*)malloc(sizeof(struct job));
-	jobs[jobs_i] = new_job;
-	jobs_i++;
+	if (timed) {
+		thread_rusage(&after);
+		add_rusage_delta(&usage, &before, &after);
+		usage.wall_ns = now_ns() - usage.wall_ns;
+		print_usage(stderr, &usage);
+	}
 }
 
-/** 
- * Function to initiate prompt and cache information
+/**
+ *  Function to execute command. The line is parsed once into a list of
+ *  pipelines joined by &&, ||, ; and &; each pipeline is expanded just
+ *  before it runs, so it sees what the ones before it changed.
  *
- * Parameters:
- * - void
+ *	Parameters:
+ *	- line: string to tokenize, then execute
  *
- * Returns: void
+ *	Returns: void
  */
-void start_prompt(void) {
-	/* Get information from getpwuid */
-	struct passwd *passwd;
-	passwd = getpwuid(getuid());
+void execute(char *line) {
+	int i;
 
-	/* Get username */
-	strcpy(username, passwd->pw_name);
+	/* Parse, or reuse the parse of an identical earlier line */
+	struct parsed_line *pl = parse_line(line);
+	if (pl == NULL) {
+		return;
+	}
 
-	/* Get hostname */
-	hostname[HOST_NAME_MAX - 1] = '\0';
-	gethostname(hostname, HOST_NAME_MAX - 1);
+	for (i = 0; i < pl->num_pipelines; i++) {
+		struct parsed_pipeline *pp = &pl->pipelines[i];
 
-	/* Get home directory */
-	strcpy(home_dir, passwd->pw_dir);
+		/* Short-circuit on the status of the last pipeline that ran */
+		if ((pp->op == LIST_AND && last_status != 0)
+				|| (pp->op == LIST_OR && last_status == 0)) {
+			continue;
+		}
 
-	/* Get current working directory */
-	cwd[PATH_MAX - 1] = '\0';
-	getcwd(cwd, PATH_MAX - 1);
+		struct pipeline *p = build_pipeline(pl, pp);
+		if (p == NULL) {
+			perror("execute");
+			break;
+		}
+		run_pipeline(p, pl->num_pipelines == 1 ? line : NULL, i == pl->num_pipelines - 1);
+
+		/* Like other shells, stop the list when ^C killed its command */
+		if (last_status == 128 + SIGINT) {
+			break;
+		}
+	}
+
+	parse_release(pl);
 }
 
-/** 
- * Function to print and update prompt
+/**
+ * Function to execute command through pipeline. The shell starts every stage
+ * itself, so an N-stage pipeline is N direct children (or threads, for
+ * builtins) rather than a chain of nested processes, and a foreground
+ * pipeline waits on all of them.
  *
- * Parameters: 
- * - void
+ * Parameters:
+ * - p: pipeline to run
+ * - usage: NULL, or a total to add what the stages used to
  *
- * Returns: void
+ * Returns: exit status of the last stage, or -1 if the pipeline was sent to
+ * the background.
  */
-void print_prompt(void) {
-	getcwd(cwd, PATH_MAX - 1);
+int execute_pipeline(struct pipeline *p, struct usage *usage) {
+	struct stage *stages = arena_alloc(&line_arena, sizeof(struct stage) * p->num_cmds);
+	int ret = -1;
 
-	/* If in home directory, replace with "~" */
-	if (startsWith(home_dir, cwd)) {
-    	printf("--[%d|%s@%s:%s]--$ ", cmd_id, username, hostname, replace_str(cwd, home_dir, "~"));
+	if (stages == NULL) {
+		perror("execute_pipeline");
+		return ret;
+	}
+
+	int launched = launch_pipeline(p, stages);
+	if (p->background) {
+		/* Stages before the last are reaped by the main loop */
+		if (launched == 0 && stages[p->num_cmds - 1].pid != -1) {
+			background_cmd(p->cmds[0].tokens, stages[p->num_cmds - 1].pid);
+			last_status = 0;
+		}
 	} else {
-    	printf("--[%d|%s@%s:%s]--$ ", cmd_id, username, hostname, cwd);
+		/* Stages that did start are waited on even if a later one failed */
+		ret = wait_pipeline(stages, p->num_cmds, usage);
 	}
 
-    fflush(stdout);
+	return ret;
 }
 
 /**
- * Helper function to see if string starts with substring
+ * Function to join a command's tokens into the line shown for its job
  *
  * Parameters:
- * - pre: check if str starts with this line
- * - str: check if this line starts with pre
+ * - tokens: tokens of the command
+ * - suffix: text to end the line with
  *
- * Returns: true if successful, false if unsuccessful.
+ * Returns: newly allocated line, or NULL if there are no tokens.
  */
-bool startsWith(const char *pre, const char *str) {
-	size_t lenpre = strlen(pre),lenstr = strlen(str);
-	return lenstr < lenpre ? false : strncmp(pre, str, lenpre) == 0;
+char *join_tokens(char *tokens[], const char *suffix) {
+	/* Size the line: each token plus a space, then the suffix */
+	int i = 0;
+	size_t cmd_sz = strlen(suffix) + 1;
+	while (tokens[i] != NULL) {
+		cmd_sz += strlen(tokens[i]) + 1;
+		i++;
+	}
+
+	/* If no line, there is nothing to show */
+	if (i == 0) {
+		return NULL;
+	}
+
+	char *cmd = malloc(cmd_sz), *end = cmd;
+	if (cmd == NULL) {
+		return NULL;
+	}
+	for (i = 0; tokens[i] != NULL; i++) {
+		size_t len = strlen(tokens[i]);
+		memcpy(end, tokens[i], len);
+		end[len] = ' ';
+		end += len + 1;
+	}
+	strcpy(end, suffix);
+	return cmd;
 }
 
 /**
- * Helper function to replace a string with substring
+ * Function to allow the shell to support background jobs
  *
  * Parameters:
- * - str: string to replace
- * - orig: original string
- * - rep: string to replace
+ * - tokens: tokens to execvp in the background
+ * - pid: pid to add to jobs
  *
- * Returns: new, replaced string
+ * Returns: void
  */
-char *replace_str(char *str, char *orig, char *rep) {
-	static char buffer[BUF_SZ];
-	char *p;
-	
-	/* Check if 'orig' is in 'str' */
-	if (!(p = strstr(str, orig))) {
-		return str;
+void background_cmd(char *tokens[], pid_t pid) {
+	/* If no line, do not add to list and return */
+	char *cmd = join_tokens(tokens, "&\n");
+	if (cmd == NULL) {
+		return;
 	}
 
-	/* Copy character from 'str' start to 'orig' */
-    strncpy(buffer, str, p-str);
-	buffer[p-str] = '\0';
-
-	sprintf(buffer+(p-str), "%s%s", rep, p+strlen(orig));
-
-    return buffer;
+	/* Else, add to jobs list */
+	struct job *job = add_job(pid, cmd);
+	if (job != NULL && interactive) {
+		fprintf(stderr, "[%zu] %d\n", job_number(job), pid);
+	}
 }
 
 /**
- * Helper function to delete job struct from jobs list
+ * Helper function to see if string starts with substring
  *
  * Parameters:
- * - pid: pid to delete
+ * - pre: check if str starts with this line
+ * - str: check if this line starts with pre
  *
- * Returns: void
- */ 
-void delete_job(pid_t pid) { 
-	/* Search for pid in jobs list */
-	int i;
-	for (i = 0; i < jobs_i; ++i) {
-		if (jobs[i]->pid == pid) {
-			break;
-		}
-	}
-	
-	/* If pid found in list */
-	if (i < jobs_i) {
-		/* Reduce size of jobs list */
-		jobs_i -= 1;
-		/* Move all elements one space ahead */
-		for (int j = i; j < jobs_i; ++j) {
-			jobs[j] = jobs[j + 1];
-		}
-	}
+ * Returns: true if successful, false if unsuccessful.
+ */
+bool startsWith(const char *pre, const char *str) {
+	size_t lenpre = strlen(pre),lenstr = strlen(str);
+	return lenstr < lenpre ? false : strncmp(pre, str, lenpre) == 0;
 }
- 
@@ -9,38 +9,68 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+
+#include "arena.h"
+#include "stats.h"
 
 /* Preprocessor Directives */
-#define ARG_MAX 4096
 #define BUF_SZ 128
 
-/* Struct to store command line information */
+/* Kinds of redirection */
+enum redirect_type {
+    REDIR_IN,       /* < file */
+    REDIR_OUT,      /* > file */
+    REDIR_APPEND,   /* >> file */
+    REDIR_ERR,      /* 2> file */
+};
+
+/* Struct to store a redirection; a command's are applied in order */
+struct redirect {
+    enum redirect_type type;
+    char *path;
+};
+
+/* Struct to store command line information: one simple command */
 struct command_line {
     char **tokens;
     bool stdout_pipe;
-    char *stdout_file;
+    struct redirect *redirs;
+    int num_redirs;
 };
 
-/* Struct to store background job information */
-struct job {
-	pid_t pid;
-	char *cmd;
+/* Struct to store a pipeline of simple commands */
+struct pipeline {
+    struct command_line *cmds;
+    int num_cmds;
+    int background;
+    bool timed;
 };
 
+/* Per-line allocations, released after each command line */
+extern struct arena line_arena;
+
+/* Shell state shared with the builtins */
+extern char home_dir[], cwd[];
+extern bool interactive;
+extern int cmd_id, line_id;
+
 /* Function Prototypes */
+void sigint_handler(int signo);
+void run_script(char *script, size_t len);
+int run_script_file(const char *path);
+void run_stdin(void);
 void execute(char *line);
-int execute_pipeline(struct command_line *cmds);
-bool builtin_cmd(char *tokens[], char *line);
+int execute_pipeline(struct pipeline *p, struct usage *usage);
+char *join_tokens(char *tokens[], const char *suffix);
 void background_cmd(char *tokens[], pid_t pid);
-void start_prompt(void);
-void print_prompt(void);
 bool startsWith(const char *pre, const char *str);
-char *replace_str(char *str, char *orig, char *rep);
-void delete_job(pid_t pid);
 
 #endif
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+
+#include "stats.h"
+#include "debug.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Globals */
+struct cmd_stats **stats_table;
+size_t stats_table_sz, stats_table_count;
+
+/**
+ * Function to read the monotonic clock
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: current time in nanoseconds.
+ */
+long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Function to get what the calling thread of the shell has used so far
+ *
+ * Parameters:
+ * - ru: filled in by getrusage(RUSAGE_THREAD)
+ *
+ * Returns: void
+ */
+void thread_rusage(struct rusage *ru) {
+	if (getrusage(RUSAGE_THREAD, ru) == -1) {
+		memset(ru, 0, sizeof(struct rusage));
+	}
+}
+
+/**
+ * Function to convert a timeval from getrusage() or wait4() to nanoseconds
+ */
+static long long timeval_ns(const struct timeval *tv) {
+	return tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL;
+}
+
+/**
+ * Function to add what a process used to a total. Peak memory is summed
+ * too, since the stages of a pipeline all run at once.
+ *
+ * Parameters:
+ * - usage: total to add to
+ * - ru: resources filled in by wait4()
+ *
+ * Returns: void
+ */
+void add_rusage(struct usage *usage, const struct rusage *ru) {
+	usage->user_ns += timeval_ns(&ru->ru_utime);
+	usage->sys_ns += timeval_ns(&ru->ru_stime);
+	usage->maxrss_kb += ru->ru_maxrss;
+	usage->nvcsw += ru->ru_nvcsw;
+	usage->nivcsw += ru->ru_nivcsw;
+}
+
+/**
+ * Function to add what a thread of the shell used between two calls to
+ * getrusage(RUSAGE_THREAD) to a total. Its memory is the shell's and is
+ * not counted.
+ *
+ * Parameters:
+ * - usage: total to add to
+ * - before: resources used before
+ * - after: resources used after
+ *
+ * Returns: void
+ */
+void add_rusage_delta(struct usage *usage, const struct rusage *before, const struct rusage *after) {
+	usage->user_ns += timeval_ns(&after->ru_utime) - timeval_ns(&before->ru_utime);
+	usage->sys_ns += timeval_ns(&after->ru_stime) - timeval_ns(&before->ru_stime);
+	usage->nvcsw += after->ru_nvcsw - before->ru_nvcsw;
+	usage->nivcsw += after->ru_nivcsw - before->ru_nivcsw;
+}
+
+/**
+ * Function to print a duration the way time does, e.g. 0m1.250s
+ */
+static void print_duration(FILE *out, const char *label, long long ns) {
+	long long ms = ns / 1000000;
+	fprintf(out, "%s\t%lldm%lld.%03llds\n", label, ms / 60000, ms / 1000 % 60, ms % 1000);
+}
+
+/**
+ * Function to print what a timed pipeline used
+ *
+ * Parameters:
+ * - out: stream to print to
+ * - usage: resources used
+ *
+ * Returns: void
+ */
+void print_usage(FILE *out, const struct usage *usage) {
+	fputc('\n', out);
+	print_duration(out, "real", usage->wall_ns);
+	print_duration(out, "user", usage->user_ns);
+	print_duration(out, "sys", usage->sys_ns);
+	fprintf(out, "maxrss\t%ldk\n", usage->maxrss_kb);
+	fprintf(out, "ctxsw\t%ld voluntary, %ld involuntary\n", usage->nvcsw, usage->nivcsw);
+}
+
+/**
+ * Function to hash a command name (FNV-1a)
+ *
+ * Parameters:
+ * - name: command name to hash
+ *
+ * Returns: hash of the name.
+ */
+static size_t hash_name(const char *name) {
+	size_t hash = 14695981039346656037UL;
+	while (*name != '\0') {
+		hash ^= (unsigned char)*name++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/**
+ * Function to find the slot a command name lives in, or the empty slot it
+ * would be inserted into. The table is open addressed with linear probing.
+ *
+ * Parameters:
+ * - name: command name to find
+ *
+ * Returns: pointer to the matching or empty slot.
+ */
+static struct cmd_stats **find_slot(const char *name) {
+	size_t mask = stats_table_sz - 1;
+	size_t i = hash_name(name) & mask;
+	while (stats_table[i] != NULL && strcmp(stats_table[i]->name, name) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &stats_table[i];
+}
+
+/**
+ * Function to double the size of the table and rehash every entry
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: false if memory cannot be allocated.
+ */
+static bool grow_table(void) {
+	struct cmd_stats **old = stats_table;
+	size_t old_sz = stats_table_sz, i;
+
+	size_t sz = old_sz == 0 ? STATS_TABLE_INIT_SZ : old_sz * 2;
+	struct cmd_stats **table = calloc(sz, sizeof(struct cmd_stats *));
+	if (table == NULL) {
+		return false;
+	}
+	stats_table = table;
+	stats_table_sz = sz;
+	for (i = 0; i < old_sz; i++) {
+		if (old[i] != NULL) {
+			*find_slot(old[i]->name) = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+/**
+ * Function to get the histogram bucket of a latency
+ *
+ * Parameters:
+ * - ns: latency in nanoseconds
+ *
+ * Returns: bucket index.
+ */
+static size_t bucket_of(long long ns) {
+	unsigned long long v = ns < 0 ? 0 : ns;
+	if (v < (1ULL << STATS_SUB_BITS)) {
+		return v;
+	}
+	int bits = 64 - __builtin_clzll(v);
+	if (bits > STATS_MAX_BITS) {
+		return STATS_BUCKETS - 1;
+	}
+	/* The power of two picks the group, the next bits the bucket in it */
+	size_t sub = (v >> (bits - 1 - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1);
+	return ((size_t)(bits - STATS_SUB_BITS) << STATS_SUB_BITS) + sub;
+}
+
+/**
+ * Function to get the smallest latency that falls in a bucket
+ *
+ * Parameters:
+ * - bucket: bucket index
+ *
+ * Returns: latency in nanoseconds.
+ */
+static long long bucket_floor(size_t bucket) {
+	size_t group = bucket >> STATS_SUB_BITS, sub = bucket & ((1 << STATS_SUB_BITS) - 1);
+	if (group == 0) {
+		return sub;
+	}
+	return (long long)((1 << STATS_SUB_BITS) + sub) << (group - 1);
+}
+
+/**
+ * Function to record how long a command took
+ *
+ * Parameters:
+ * - name: command name
+ * - ns: how long it ran, in nanoseconds
+ *
+ * Returns: void
+ */
+void record_latency(const char *name, long long ns) {
+	if (name == NULL) {
+		return;
+	}
+
+	/* Keep the load factor at or below one half */
+	if ((stats_table_count + 1) * 2 > stats_table_sz && !grow_table()) {
+		return;
+	}
+
+	struct cmd_stats **slot = find_slot(name);
+	if (*slot == NULL) {
+		struct cmd_stats *stats = calloc(1, sizeof(struct cmd_stats));
+		if (stats == NULL || (stats->name = strdup(name)) == NULL) {
+			free(stats);
+			return;
+		}
+		*slot = stats;
+		stats_table_count++;
+	}
+
+	struct cmd_stats *stats = *slot;
+	if (stats->count == 0 || ns < stats->min_ns) {
+		stats->min_ns = ns;
+	}
+	stats->count++;
+	stats->total_ns += ns;
+	if (ns > stats->max_ns) {
+		stats->max_ns = ns;
+	}
+	stats->buckets[bucket_of(ns)]++;
+}
+
+/**
+ * Function to estimate a percentile of a command's latency: the middle of
+ * the bucket it falls in, kept within the smallest and largest latency seen
+ *
+ * Parameters:
+ * - stats: histogram of the command
+ * - pct: percentile, 0 to 100
+ *
+ * Returns: latency in nanoseconds.
+ */
+static long long percentile(const struct cmd_stats *stats, int pct) {
+	uint64_t rank = (stats->count * pct + 99) / 100, seen = 0;
+	size_t i;
+
+	if (rank == 0) {
+		rank = 1;
+	}
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += stats->buckets[i];
+		if (seen >= rank) {
+			long long lo = bucket_floor(i);
+			long long hi = i + 1 < STATS_BUCKETS ? bucket_floor(i + 1) : lo;
+			long long mid = lo + (hi - lo) / 2;
+			if (mid < stats->min_ns) {
+				return stats->min_ns;
+			}
+			return mid < stats->max_ns ? mid : stats->max_ns;
+		}
+	}
+	return stats->max_ns;
+}
+
+/**
+ * Function to print a latency in a unit that suits it
+ */
+static void print_latency(FILE *out, long long ns) {
+	if (ns < 1000) {
+		fprintf(out, "%lldns\t", ns);
+	} else if (ns < 1000000) {
+		fprintf(out, "%.1fus\t", ns / 1e3);
+	} else if (ns < 1000000000) {
+		fprintf(out, "%.1fms\t", ns / 1e6);
+	} else {
+		fprintf(out, "%.2fs\t", ns / 1e9);
+	}
+}
+
+/**
+ * Function to order commands by the total time spent in them, most first
+ */
+static int compare_total(const void *a, const void *b) {
+	const struct cmd_stats *sa = *(struct cmd_stats * const *)a, *sb = *(struct cmd_stats * const *)b;
+	return sa->total_ns < sb->total_ns ? 1 : sa->total_ns > sb->total_ns ? -1 : strcmp(sa->name, sb->name);
+}
+
+/**
+ * Function to print the latency of every command run this session, the
+ * commands that took the most time in total first
+ *
+ * Parameters:
+ * - out: stream to print to
+ *
+ * Returns: void
+ */
+void print_stats(FILE *out) {
+	size_t i, n = 0;
+
+	if (stats_table_count == 0) {
+		fprintf(out, "stats: no commands run\n");
+		return;
+	}
+
+	struct cmd_stats **sorted = malloc(sizeof(struct cmd_stats *) * stats_table_count);
+	if (sorted == NULL) {
+		perror("stats");
+		return;
+	}
+	for (i = 0; i < stats_table_sz; i++) {
+		if (stats_table[i] != NULL) {
+			sorted[n++] = stats_table[i];
+		}
+	}
+	qsort(sorted, n, sizeof(struct cmd_stats *), compare_total);
+
+	fprintf(out, "count\tp50\tp99\tmax\ttotal\tcommand\n");
+	for (i = 0; i < n; i++) {
+		fprintf(out, "%5llu\t", (unsigned long long)sorted[i]->count);
+		print_latency(out, percentile(sorted[i], 50));
+		print_latency(out, percentile(sorted[i], 99));
+		print_latency(out, sorted[i]->max_ns);
+		print_latency(out, sorted[i]->total_ns);
+		fprintf(out, "%s\n", sorted[i]->name);
+	}
+	free(sorted);
+}
+
+/**
+ * Function to forget every recorded latency
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void clear_stats(void) {
+	size_t i;
+	for (i = 0; i < stats_table_sz; i++) {
+		if (stats_table[i] != NULL) {
+			free(stats_table[i]->name);
+			free(stats_table[i]);
+			stats_table[i] = NULL;
+		}
+	}
+	stats_table_count = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+/* Preprocessor Directives */
+#define STATS_TABLE_INIT_SZ 32
+#define STATS_SUB_BITS 3                      /* 8 buckets per power of two */
+#define STATS_MAX_BITS 48                     /* Latencies up to ~78 hours */
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+/* Struct to store the resources used by a command or pipeline */
+struct usage {
+	long long wall_ns;
+	long long user_ns;
+	long long sys_ns;
+	long maxrss_kb;
+	long nvcsw;
+	long nivcsw;
+};
+
+/* Struct to store the latency histogram of a command name. Buckets are
+ * log-linear: each power of two is split into 2^STATS_SUB_BITS equal
+ * buckets, so a percentile is off by at most 12.5%. */
+struct cmd_stats {
+	char *name;
+	uint64_t count;
+	long long total_ns;
+	long long min_ns;
+	long long max_ns;
+	uint32_t buckets[STATS_BUCKETS];
+};
+
+/* Function Prototypes */
+long long now_ns(void);
+void thread_rusage(struct rusage *ru);
+void add_rusage(struct usage *usage, const struct rusage *ru);
+void add_rusage_delta(struct usage *usage, const struct rusage *before, const struct rusage *after);
+void print_usage(FILE *out, const struct usage *usage);
+void record_latency(const char *name, long long ns);
+void clear_stats(void);
+void print_stats(FILE *out);
+
+#endif
@@ -1,136 +1,526 @@
 #include "tokenizer.h"
+#include "debug.h"
+#include "exec.h"
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern char **environ;
+
+/* Characters that end a run of ordinary characters outside of quotes */
+static const char word_special[] = " \t\r\n\'\"\\|<>&;$";
+
+/* Characters that end a run of ordinary characters inside double quotes */
+static const char dquote_special[] = "\"\\$";
+
+/* Lookup tables built from the sets above, indexed by character */
+static unsigned char is_word_special[256], is_dquote_special[256];
+
+/**
+ * Fills the lookup tables used by the scalar scanning loops.
+ */
+static void init_tables(void)
+{
+    const char *c;
+    for (c = word_special; *c != '\0'; c++) {
+        is_word_special[(unsigned char)*c] = 1;
+    }
+    for (c = dquote_special; *c != '\0'; c++) {
+        is_dquote_special[(unsigned char)*c] = 1;
+    }
+}
+
 /**
- * Retrieves the next token from a string.
+ * Counts how many characters at the start of a buffer are ordinary, i.e. not
+ * in the given special set. Long arguments are skipped 16 (SSE2) or 32 (AVX2)
+ * bytes at a time by comparing a whole vector against every special character
+ * at once; the remainder is finished with a table lookup per character.
  *
  * Parameters:
- * - str_ptr: maintains context in the string, i.e., where the next token in the
- *   string will be. If the function returns token N, then str_ptr will be
- *   updated to point to token N+1. To initialize, declare a char * that points
- *   to the string being tokenized. The pointer will be updated after each
- *   successive call to next_token.
+ * - str: start of the run
+ * - len: number of characters available
+ * - set: the special characters
+ * - table: lookup table for the same set
  *
- * - delim: the set of characters to use as delimiters
+ * Returns: length of the run of ordinary characters.
+ */
+static size_t span_plain(const char *str, size_t len, const char *set,
+        const unsigned char *table)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    while (i + 32 <= len) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i hits = _mm256_setzero_si256();
+        const char *c;
+        for (c = set; *c != '\0'; c++) {
+            hits = _mm256_or_si256(hits,
+                    _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(*c)));
+        }
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    while (i + 16 <= len) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i hits = _mm_setzero_si128();
+        const char *c;
+        for (c = set; *c != '\0'; c++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(*c)));
+        }
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+#endif
+
+    while (i < len && !table[(unsigned char)str[i]]) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Returns a character that was quoted or escaped. A literal '$' is replaced
+ * by LEX_LITERAL_DOLLAR so that expansion can tell it apart from a variable
+ * reference; expand_var() turns it back into a '$'.
+ */
+static char literal_char(char c, int *flags)
+{
+    if (c == '$') {
+        *flags |= TOK_LITERAL;
+        return LEX_LITERAL_DOLLAR;
+    }
+    return c;
+}
+
+/**
+ * Marks every '$' in a run of single-quoted text as literal.
+ */
+static void mark_literal_dollars(char *str, size_t len, int *flags)
+{
+    char *dollar = memchr(str, '$', len);
+    while (dollar != NULL) {
+        *dollar = literal_char(*dollar, flags);
+        dollar = memchr(dollar + 1, '$', len - (dollar + 1 - str));
+    }
+}
+
+/**
+ * Appends a token to a token list, growing the list in the arena as needed.
  *
- * Returns: char pointer to the next token in the string.
+ * Returns: 0 on success, -1 if memory cannot be allocated.
  */
-char *next_token(char **str_ptr, const char *delim)
+static int push_token(struct arena *a, struct token_list *list,
+        enum token_type type, int flags, char *start, size_t len)
 {
-    if (*str_ptr == NULL) {
-        return NULL;
+    if (list->count == list->cap) {
+        size_t cap = list->cap == 0 ? 16 : list->cap * 2;
+        struct token *tokens = arena_alloc(a, sizeof(struct token) * cap);
+        if (tokens == NULL) {
+            return -1;
+        }
+        if (list->count > 0) {
+            memcpy(tokens, list->tokens, sizeof(struct token) * list->count);
+        }
+        list->tokens = tokens;
+        list->cap = cap;
     }
 
-	char quotes[] = "\'\"";
+    struct token *tok = &list->tokens[list->count++];
+    tok->type = type;
+    tok->flags = flags;
+    tok->start = start;
+    tok->len = len;
+    return 0;
+}
 
-    size_t tok_start = strspn(*str_ptr, delim);
-    size_t tok_end = strcspn(*str_ptr + tok_start, delim);
-	size_t quote_start = strcspn(*str_ptr, quotes);
+/**
+ * Splits a command line into words and operators in a single left-to-right
+ * pass. Quotes are removed and escapes resolved as the line is scanned, so
+ * adjacent and mixed quoting such as a"b c"'d' yields the single word "ab cd".
+ *
+ * Word tokens point into a buffer allocated from the arena and are NUL
+ * terminated; operator tokens point at static strings. A '#' at the start of
+ * a word begins a comment, which ends the line.
+ *
+ * Parameters:
+ * - a: arena to allocate the word buffer and token array from
+ * - line: the command line; it is not modified
+ * - list: filled with the tokens of the line
+ *
+ * Returns: 0 on success, -1 if memory cannot be allocated.
+ */
+int lex_line(struct arena *a, const char *line, struct token_list *list)
+{
+    static bool tables_ready = false;
+    if (!tables_ready) {
+        init_tables();
+        tables_ready = true;
+    }
 
-    /* Zero length token. We must be finished. */
-    if (tok_end  <= 0) {
-        *str_ptr = NULL;
-        return NULL;
+    size_t len = strlen(line);
+    const char *r = line, *end = line + len;
+
+    /* Output never exceeds the input: quotes and escapes only shrink it, and
+     * every word's NUL takes the place of the delimiter that ended it. */
+    char *w = arena_alloc(a, len + 1);
+    if (w == NULL) {
+        return -1;
     }
 
-	/* Remove quotes */
-	if (quote_start < tok_end) {
-		/* Remove the opposite type of quote */
-		quotes[0] = *(*str_ptr + quote_start);
-		quotes[1] = '\0';
-		size_t offset = quote_start + 1;
-		size_t quote_end = strcspn(*str_ptr + offset, quotes) + offset;
-		tok_end = strcspn(*str_ptr + quote_end, delim) + quote_end - tok_start;
-	}
+    list->tokens = NULL;
+    list->count = list->cap = 0;
 
-    /* Take note of the start of the current token. We'll return it later. */
-    char *current_ptr = *str_ptr + tok_start;
+    while (r < end) {
+        char c = *r;
 
-    /* Shift pointer forward (to the end of the current token) */
-    *str_ptr += tok_start + tok_end;
+        /* Skip blanks between tokens */
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            r++;
+            continue;
+        }
 
-    if (**str_ptr == '\0') {
-        /* If the end of the current token is also the end of the string, we
-         * must be at the last token. */
-        *str_ptr = NULL;
-    } else {
-        /* Replace the matching delimiter with a NUL character to terminate the
-         * token string. */
-        **str_ptr = '\0';
+        /* Allow comments with # */
+        if (c == '#') {
+            break;
+        }
+
+        /* Operators */
+        if (c == '|' || c == '>' || c == '<' || c == '&' || c == ';') {
+            static char op_pipe[] = "|", op_or[] = "||", op_gt[] = ">",
+                    op_dgt[] = ">>", op_lt[] = "<", op_amp[] = "&",
+                    op_and[] = "&&", op_semi[] = ";";
+            bool doubled = r + 1 < end && r[1] == c;
+            enum token_type type;
+            char *op;
+            if (c == '|') {
+                type = doubled ? TOK_OR : TOK_PIPE;
+                op = doubled ? op_or : op_pipe;
+            } else if (c == '<') {
+                type = TOK_LT;
+                op = op_lt;
+            } else if (c == '&') {
+                type = doubled ? TOK_AND : TOK_AMP;
+                op = doubled ? op_and : op_amp;
+            } else if (c == ';') {
+                type = TOK_SEMI;
+                op = op_semi;
+            } else if (doubled) {
+                type = TOK_DGT;
+                op = op_dgt;
+            } else {
+                type = TOK_GT;
+                op = op_gt;
+            }
+            size_t op_len = strlen(op);
+            if (push_token(a, list, type, 0, op, op_len) == -1) {
+                return -1;
+            }
+            r += op_len;
+            continue;
+        }
+
+        /* Word: runs until an unquoted blank or operator */
+        const char *word_r = r;
+        char *start = w;
+        int flags = 0;
+        while (r < end) {
+            size_t run = span_plain(r, end - r, word_special, is_word_special);
+            memcpy(w, r, run);
+            w += run;
+            r += run;
+            if (r == end) {
+                break;
+            }
 
-        /* Shift forward one character over the newly-placed NUL so that
-         * next_pointer now points at the first character of the next token. */
-        (*str_ptr)++;
+            c = *r;
+            if (c == '$') {
+                /* Keep ${...} in one word even if the default has blanks */
+                const char *close = NULL;
+                if (r + 1 < end && r[1] == '{') {
+                    close = memchr(r, '}', end - r);
+                }
+                size_t ref = close == NULL ? 1 : (size_t)(close + 1 - r);
+                flags |= TOK_EXPAND;
+                memcpy(w, r, ref);
+                w += ref;
+                r += ref;
+            } else if (c == '\\') {
+                /* Backslash keeps the next character literally */
+                r++;
+                if (r < end) {
+                    *w++ = literal_char(*r++, &flags);
+                }
+            } else if (c == '\'') {
+                /* Everything up to the closing quote is literal */
+                r++;
+                const char *close = memchr(r, '\'', end - r);
+                size_t quoted = close == NULL ? (size_t)(end - r) : (size_t)(close - r);
+                memcpy(w, r, quoted);
+                mark_literal_dollars(w, quoted, &flags);
+                w += quoted;
+                r += quoted + (close != NULL);
+            } else if (c == '"') {
+                /* Only \, " and $ are special inside double quotes */
+                r++;
+                while (r < end) {
+                    run = span_plain(r, end - r, dquote_special, is_dquote_special);
+                    memcpy(w, r, run);
+                    w += run;
+                    r += run;
+                    if (r == end) {
+                        break;
+                    }
+                    c = *r;
+                    if (c == '"') {
+                        r++;
+                        break;
+                    } else if (c == '$') {
+                        flags |= TOK_EXPAND;
+                        *w++ = *r++;
+                    } else if (r + 1 < end && strchr("\\\"$", r[1]) != NULL) {
+                        /* \\, \" and \$ lose their backslash */
+                        *w++ = literal_char(r[1], &flags);
+                        r += 2;
+                    } else {
+                        *w++ = *r++;
+                    }
+                }
+            } else {
+                /* Blank or operator ends the word */
+                break;
+            }
+        }
+
+        /* A bare 2 right before > redirects stderr */
+        if (r - word_r == 1 && *word_r == '2' && r < end && *r == '>') {
+            static char op_err_gt[] = "2>";
+            if (push_token(a, list, TOK_ERR_GT, 0, op_err_gt, 2) == -1) {
+                return -1;
+            }
+            w = start;
+            r++;
+            continue;
+        }
+
+        *w = '\0';
+        if (push_token(a, list, TOK_WORD, flags, start, w - start) == -1) {
+            return -1;
+        }
+        w++;
     }
 
-    return current_ptr;
+    return 0;
 }
 
+/* A $ reference found in a word */
+struct var_ref {
+    size_t offset;      /* Where the '$' is in the word */
+    size_t ref_len;     /* Length of the reference, including the '$' */
+    const char *value;  /* What it expands to */
+    size_t value_len;
+};
+
 /**
- * Expands environment variables (identified by $ prefix, e.g., $SHELL) in a
- * string by resizing and inserting the value of the variable into the string.
- * This function only does one expansion, but can be called multiple times on a
- * string to expand more than one variable.
- * 
- * NOTE: this function allocates memory! The caller is responsible for freeing
- * the memory. 
- *
- * Parameters:
- * - str: The string with variables to expand
+ * Looks up an environment variable by a name that is not NUL terminated.
  *
- * Returns: char pointer to the newly-expanded and allocated string. Returns
- * NULL if there are no variables to replace or if memory cannot be allocated.
+ * Returns: the value, or NULL if the variable is not set.
  */
-char *expand_var(char *str)
+static const char *lookup_var(const char *name, size_t len)
 {
-    size_t var_start = 0;
-    var_start = strcspn(str, "$");
-    if (var_start == strlen(str)) {
-        /* No variable to replace */
-        return NULL;
+    char **env;
+    for (env = environ; *env != NULL; env++) {
+        if (strncmp(*env, name, len) == 0 && (*env)[len] == '=') {
+            return *env + len + 1;
+        }
     }
+    return NULL;
+}
 
-    size_t var_len = strcspn(str + var_start, " \t\r\n\'\"");
-
-    char *var_name = malloc(sizeof(char) * var_len + 1);
-    if (var_name == NULL) {
-        return NULL;
+/**
+ * Returns the length of the variable name at the start of str.
+ */
+static size_t name_len(const char *str, size_t len)
+{
+    size_t i = 0;
+    if (len == 0 || !(isalpha((unsigned char)str[0]) || str[0] == '_')) {
+        return 0;
+    }
+    while (i < len && (isalnum((unsigned char)str[i]) || str[i] == '_')) {
+        i++;
     }
-    strncpy(var_name, str + var_start, var_len);
-    var_name[var_len] = '\0';
+    return i;
+}
 
-    if (strlen(var_name) <= 1) {
-        free(var_name);
-        return NULL;
+/**
+ * Parses the reference starting at a '$' and resolves its value. Supported
+ * forms are $NAME, ${NAME}, ${NAME:-default} and $?.
+ *
+ * Parameters:
+ * - a: arena for expanding a default value
+ * - str: the word, starting at the '$'
+ * - len: characters left in the word
+ * - status: text of the last exit status, for $?
+ * - ref: filled with the reference's length and value
+ *
+ * Returns: true if this is a reference, false if the '$' is just a '$'.
+ */
+static bool parse_var_ref(struct arena *a, const char *str, size_t len,
+        const char *status, struct var_ref *ref)
+{
+    const char *value = NULL;
+    size_t n;
+
+    if (len >= 2 && str[1] == '?') {
+        ref->ref_len = 2;
+        value = status;
+    } else if (len >= 2 && str[1] == '{') {
+        const char *close = memchr(str + 2, '}', len - 2);
+        if (close == NULL) {
+            return false;
+        }
+        size_t inner = close - (str + 2);
+        n = name_len(str + 2, inner);
+        if (n == 0) {
+            return false;
+        }
+        value = lookup_var(str + 2, n);
+        if (n == inner) {
+            /* ${NAME} */
+        } else if (inner - n >= 2 && str[2 + n] == ':' && str[3 + n] == '-') {
+            /* ${NAME:-default} uses the default if NAME is unset or empty */
+            if (value == NULL || value[0] == '\0') {
+                const char *def = str + 4 + n;
+                size_t def_len = inner - n - 2;
+                /* The default may itself refer to variables */
+                if (memchr(def, '$', def_len) != NULL) {
+                    def = expand_var(a, def, def_len);
+                    def_len = def == NULL ? 0 : strlen(def);
+                }
+                ref->value = def == NULL ? "" : def;
+                ref->value_len = def_len;
+                ref->ref_len = inner + 3;
+                return true;
+            }
+        } else {
+            return false;
+        }
+        ref->ref_len = inner + 3;
+    } else {
+        n = name_len(str + 1, len - 1);
+        if (n == 0) {
+            return false;
+        }
+        value = lookup_var(str + 1, n);
+        ref->ref_len = n + 1;
     }
 
-    /* Use index 1 to ignore the '$' prefix */
-    char *value = getenv(&var_name[1]);
     if (value == NULL) {
-        fprintf(stderr, "value was null\n");
         value = "";
     }
+    ref->value = value;
+    ref->value_len = strlen(value);
+    return true;
+}
 
-    fprintf(stderr, "Replacing variable: %s='%s'\n", var_name, value);
-    free(var_name);
+/**
+ * Expands environment variables (identified by $ prefix, e.g., $SHELL) in a
+ * word. The word is walked once to find every reference and resolve its
+ * value, which gives the exact size of the result; the result is then
+ * written into a single buffer. This keeps expansion linear in the size of
+ * the word no matter how many variables it contains.
+ *
+ * Supported forms are $NAME, ${NAME}, ${NAME:-default} and $? (the exit
+ * status of the last pipeline). Characters marked LEX_LITERAL_DOLLAR by the
+ * lexer become a plain '$'.
+ * 
+ * NOTE: the new string lives in the arena passed in and is released when the
+ * arena is reset.
+ *
+ * Parameters:
+ * - a: arena to allocate the expanded string from
+ * - str: The word with variables to expand
+ * - len: length of the word
+ *
+ * Returns: char pointer to the newly-expanded string, or NULL if memory
+ * cannot be allocated.
+ */
+char *expand_var(struct arena *a, const char *str, size_t len)
+{
+    char status[16];
+    size_t num_refs = 0, max_refs = 0, out_sz = len, i;
+    const char *dollar;
 
-    /* Grab the size of the remaining string (after the $var): */
-    size_t remain_sz = strlen(str + var_start + var_len);
+    snprintf(status, sizeof(status), "%d", last_status);
 
-    /* Our final string contains the prefix data, the value of the variable, the
-     * remaining string size, and an extra character for the NUL byte. */
-    size_t newstr_sz = var_start + strlen(value) + remain_sz + 1;
+    /* Count the candidate references so their values can be kept */
+    for (dollar = memchr(str, '$', len); dollar != NULL;
+            dollar = memchr(dollar + 1, '$', len - (dollar + 1 - str))) {
+        max_refs++;
+    }
+
+    struct var_ref *refs = NULL;
+    if (max_refs > 0) {
+        refs = arena_alloc(a, sizeof(struct var_ref) * max_refs);
+        if (refs == NULL) {
+            return NULL;
+        }
+    }
 
-    char *newstr = malloc(sizeof(char) * newstr_sz);
+    /* First pass: resolve every reference and size the result */
+    for (i = 0; i < len; i++) {
+        if (str[i] != '$') {
+            continue;
+        }
+        struct var_ref *ref = &refs[num_refs];
+        if (parse_var_ref(a, str + i, len - i, status, ref)) {
+            LOG("Replacing variable: %.*s='%.*s'\n", (int)ref->ref_len, str + i,
+                    (int)ref->value_len, ref->value);
+            ref->offset = i;
+            out_sz = out_sz - ref->ref_len + ref->value_len;
+            i += ref->ref_len - 1;
+            num_refs++;
+        }
+    }
+
+    char *newstr = arena_alloc(a, out_sz + 1);
     if (newstr == NULL) {
         return NULL;
     }
 
-    strncpy(newstr, str, var_start);
-    newstr[var_start] = '\0';
-    strcat(newstr, value);
-    strcat(newstr, str + var_start + var_len);
+    /* Second pass: copy the text between references and their values */
+    char *out = newstr;
+    size_t pos = 0;
+    for (i = 0; i < num_refs; i++) {
+        memcpy(out, str + pos, refs[i].offset - pos);
+        out += refs[i].offset - pos;
+        memcpy(out, refs[i].value, refs[i].value_len);
+        out += refs[i].value_len;
+        pos = refs[i].offset + refs[i].ref_len;
+    }
+    memcpy(out, str + pos, len - pos);
+    out[len - pos] = '\0';
+
+    /* Quoted dollars become real ones */
+    for (out = memchr(newstr, LEX_LITERAL_DOLLAR, out_sz); out != NULL;
+            out = memchr(out + 1, LEX_LITERAL_DOLLAR, out_sz - (out + 1 - newstr))) {
+        *out = '$';
+    }
 
     return newstr;
 }
@@ -6,7 +6,47 @@
 #include <stdlib.h>
 #include <string.h>
 
-char *next_token(char **str_ptr, const char *delim);
-char *expand_var(char *str);
+#include <stdbool.h>
+
+#include "arena.h"
+
+/* Kinds of tokens produced by lex_line() */
+enum token_type {
+    TOK_WORD,
+    TOK_PIPE,
+    TOK_GT,
+    TOK_DGT,
+    TOK_LT,
+    TOK_ERR_GT,
+    TOK_AMP,
+    TOK_AND,
+    TOK_OR,
+    TOK_SEMI,
+};
+
+/* Token flags */
+#define TOK_EXPAND 0x1  /* Word contains a $ outside of single quotes */
+#define TOK_LITERAL 0x2 /* Word contains a quoted or escaped $ */
+
+/* Stands in for a quoted or escaped $ until expansion */
+#define LEX_LITERAL_DOLLAR '\x01'
+
+/* A word or operator, as a slice of the lexer's output buffer */
+struct token {
+    enum token_type type;
+    int flags;
+    char *start;
+    size_t len;
+};
+
+/* Tokens of one command line, allocated from the line's arena */
+struct token_list {
+    struct token *tokens;
+    size_t count;
+    size_t cap;
+};
+
+int lex_line(struct arena *a, const char *line, struct token_list *list);
+char *expand_var(struct arena *a, const char *str, size_t len);
 
 #endif
@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Globals */
+struct trace_record trace_ring[TRACE_RING_SZ];
+uint64_t trace_head;
+char trace_path[PATH_MAX];
+bool trace_path_shared;
+pid_t trace_pid;
+static __thread pid_t trace_tid;
+
+/* Names of the events, as shown in the trace */
+static const char *const trace_names[] = {
+	[TRACE_LINE_READ] = "line read",
+	[TRACE_LEX_START] = "tokenize",
+	[TRACE_LEX_END] = "tokenize",
+	[TRACE_FORK] = "fork",
+	[TRACE_EXEC] = "exec",
+	[TRACE_WAIT] = "waitpid",
+	[TRACE_BUILTIN_START] = "builtin",
+	[TRACE_BUILTIN_END] = "builtin",
+};
+
+/* Struct to buffer the JSON being written; only write(2) is used, so a
+ * dump is safe to make from a signal handler */
+struct dump_buf {
+	int fd;
+	size_t len;
+	bool failed;
+	char data[TRACE_DUMP_BUF_SZ];
+};
+
+/**
+ * Function to record an event in the trace. Recording costs a clock read
+ * and a few stores, so it is always on.
+ *
+ * Parameters:
+ * - type: kind of event
+ * - pid: process the event is about, or 0
+ * - arg: value that depends on the kind of event
+ * - name: command or builtin name, or NULL
+ *
+ * Returns: void
+ */
+void trace_event(enum trace_type type, pid_t pid, int64_t arg, const char *name) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (trace_tid == 0) {
+		trace_tid = syscall(SYS_gettid);
+	}
+
+	uint64_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	struct trace_record *rec = &trace_ring[idx & (TRACE_RING_SZ - 1)];
+
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->ts_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->arg = arg;
+	rec->pid = pid;
+	rec->tid = trace_tid;
+	rec->type = type;
+	if (name != NULL) {
+		strncpy(rec->name, name, TRACE_NAME_SZ - 1);
+		rec->name[TRACE_NAME_SZ - 1] = '\0';
+	} else {
+		rec->name[0] = '\0';
+	}
+	__atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Function to write out what is buffered
+ */
+static void dump_flush(struct dump_buf *buf) {
+	size_t off = 0;
+	while (off < buf->len && !buf->failed) {
+		ssize_t n = write(buf->fd, buf->data + off, buf->len - off);
+		if (n == -1 && errno != EINTR) {
+			buf->failed = true;
+		} else if (n > 0) {
+			off += n;
+		}
+	}
+	buf->len = 0;
+}
+
+/**
+ * Function to add a string to the dump
+ */
+static void dump_str(struct dump_buf *buf, const char *str) {
+	while (*str != '\0') {
+		if (buf->len == TRACE_DUMP_BUF_SZ) {
+			dump_flush(buf);
+		}
+		buf->data[buf->len++] = *str++;
+	}
+}
+
+/**
+ * Function to add a string to the dump as the inside of a JSON string
+ */
+static void dump_escaped(struct dump_buf *buf, const char *str) {
+	char c[3] = { '\0', '\0', '\0' };
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			c[0] = '\\';
+			c[1] = *str;
+		} else if ((unsigned char)*str < 0x20) {
+			c[0] = '?';
+			c[1] = '\0';
+		} else {
+			c[0] = *str;
+			c[1] = '\0';
+		}
+		dump_str(buf, c);
+	}
+}
+
+/**
+ * Function to add a number to the dump
+ */
+static void dump_num(struct dump_buf *buf, int64_t num) {
+	char digits[24];
+	char *p = digits + sizeof(digits) - 1;
+	uint64_t n = num < 0 ? -(uint64_t)num : (uint64_t)num;
+
+	*p = '\0';
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n > 0);
+	if (num < 0) {
+		*--p = '-';
+	}
+	dump_str(buf, p);
+}
+
+/**
+ * Function to add one event to the dump in Chrome's trace event format.
+ * Tokenizing and builtins are duration events on the thread that ran them;
+ * a child process is an async event, matched by pid, from its fork or
+ * spawn to its reaping.
+ */
+static void dump_record(struct dump_buf *buf, const struct trace_record *rec, bool first) {
+	const char *phase;
+	bool child = false;
+
+	switch (rec->type) {
+	case TRACE_LEX_START:
+	case TRACE_BUILTIN_START:
+		phase = "B";
+		break;
+	case TRACE_LEX_END:
+	case TRACE_BUILTIN_END:
+		phase = "E";
+		break;
+	case TRACE_FORK:
+	case TRACE_EXEC:
+		phase = "b";
+		child = true;
+		break;
+	case TRACE_WAIT:
+		phase = "e";
+		child = true;
+		break;
+	default:
+		phase = "i";
+		break;
+	}
+
+	dump_str(buf, first ? "\n" : ",\n");
+	dump_str(buf, "{\"name\":\"");
+	dump_str(buf, child ? "child" : trace_names[rec->type]);
+	dump_str(buf, "\",\"cat\":\"");
+	dump_str(buf, child ? "process" : "shell");
+	dump_str(buf, "\",\"ph\":\"");
+	dump_str(buf, phase);
+	dump_str(buf, "\",\"ts\":");
+	dump_num(buf, rec->ts_ns / 1000);
+	dump_str(buf, ".");
+	dump_str(buf, rec->ts_ns % 1000 < 100 ? (rec->ts_ns % 1000 < 10 ? "00" : "0") : "");
+	dump_num(buf, rec->ts_ns % 1000);
+	dump_str(buf, ",\"pid\":");
+	dump_num(buf, trace_pid);
+	dump_str(buf, ",\"tid\":");
+	dump_num(buf, rec->tid);
+	if (child) {
+		/* Async events are matched by id */
+		dump_str(buf, ",\"id\":");
+		dump_num(buf, rec->pid);
+	} else if (phase[0] == 'i') {
+		dump_str(buf, ",\"s\":\"t\"");
+	}
+
+	dump_str(buf, ",\"args\":{");
+	switch (rec->type) {
+	case TRACE_LINE_READ:
+		dump_str(buf, "\"length\":");
+		dump_num(buf, rec->arg);
+		break;
+	case TRACE_LEX_END:
+		dump_str(buf, "\"tokens\":");
+		dump_num(buf, rec->arg);
+		break;
+	case TRACE_FORK:
+	case TRACE_EXEC:
+		dump_str(buf, "\"pid\":");
+		dump_num(buf, rec->pid);
+		dump_str(buf, ",\"via\":\"");
+		dump_str(buf, trace_names[rec->type]);
+		dump_str(buf, "\",\"command\":\"");
+		dump_escaped(buf, rec->name);
+		dump_str(buf, "\"");
+		break;
+	case TRACE_WAIT:
+	case TRACE_BUILTIN_END:
+		dump_str(buf, "\"status\":");
+		dump_num(buf, rec->arg);
+		break;
+	case TRACE_BUILTIN_START:
+		dump_str(buf, "\"command\":\"");
+		dump_escaped(buf, rec->name);
+		dump_str(buf, "\"");
+		break;
+	}
+	dump_str(buf, "}}");
+}
+
+/**
+ * Function to write the events in the ring, oldest first, as a Chrome
+ * trace (load it in chrome://tracing or Perfetto). Only write(2) is used,
+ * so this is safe to call from a signal handler.
+ *
+ * Parameters:
+ * - fd: descriptor to write the JSON to
+ *
+ * Returns: 0 on success, -1 if writing failed.
+ */
+int trace_dump(int fd) {
+	struct dump_buf buf;
+	struct trace_record rec;
+	bool first = true;
+	uint64_t i;
+
+	buf.fd = fd;
+	buf.len = 0;
+	buf.failed = false;
+
+	uint64_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	uint64_t start = head > TRACE_RING_SZ ? head - TRACE_RING_SZ : 0;
+
+	dump_str(&buf, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (i = start; i < head; i++) {
+		const struct trace_record *slot = &trace_ring[i & (TRACE_RING_SZ - 1)];
+
+		/* Copy the record, then check it was not rewritten meanwhile */
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i + 1) {
+			continue;
+		}
+		memcpy(&rec, slot, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != i + 1 || rec.type > TRACE_BUILTIN_END) {
+			continue;
+		}
+		rec.name[TRACE_NAME_SZ - 1] = '\0';
+
+		dump_record(&buf, &rec, first);
+		first = false;
+	}
+	dump_str(&buf, "\n]}\n");
+	dump_flush(&buf);
+	return buf.failed ? -1 : 0;
+}
+
+/**
+ * Function to forget every recorded event
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void trace_clear(void) {
+	size_t i;
+	for (i = 0; i < TRACE_RING_SZ; i++) {
+		__atomic_store_n(&trace_ring[i].seq, 0, __ATOMIC_RELAXED);
+	}
+}
+
+/* Signal handler to dump the trace on SIGUSR1 */
+static void trace_signal_handler(int signo) {
+	int saved_errno = errno;
+	int flags = O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC;
+
+	/* In a directory others can write to, only write a file the shell
+	 * creates itself; anything planted under the name makes the dump fail */
+	if (trace_path_shared) {
+		unlink(trace_path);
+		flags |= O_EXCL;
+	} else {
+		flags |= O_TRUNC;
+	}
+
+	int fd = open(trace_path, flags, 0600);
+	if (fd != -1) {
+		trace_dump(fd);
+		close(fd);
+	}
+	errno = saved_errno;
+}
+
+/**
+ * Function to set up tracing. SIGUSR1 dumps the trace to the file named by
+ * CRASH_TRACE, or to crash-trace.<pid>.json in XDG_RUNTIME_DIR, which only
+ * the user can write to. Without it, the file goes in TMPDIR or /tmp.
+ *
+ * Parameters:
+ * - void
+ *
+ * Returns: void
+ */
+void init_trace(void) {
+	struct sigaction sa;
+	const char *path = getenv(TRACE_FILE_VAR);
+	const char *dir = getenv(TRACE_DIR_VAR);
+
+	trace_pid = getpid();
+	if (path != NULL && path[0] != '\0') {
+		snprintf(trace_path, sizeof(trace_path), "%s", path);
+	} else {
+		if (dir == NULL || dir[0] == '\0') {
+			dir = getenv(TRACE_TMP_DIR_VAR);
+			if (dir == NULL || dir[0] == '\0') {
+				dir = "/tmp";
+			}
+			trace_path_shared = true;
+		}
+		snprintf(trace_path, sizeof(trace_path), "%s/crash-trace.%d.json", dir, trace_pid);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	LOG("Trace dumps go to %s\n", trace_path);
+}
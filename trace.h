@@ -0,0 +1,47 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Preprocessor Directives */
+#define TRACE_RING_SZ 4096          /* Events kept, a power of two */
+#define TRACE_NAME_SZ 24
+#define TRACE_FILE_VAR "CRASH_TRACE"
+#define TRACE_DIR_VAR "XDG_RUNTIME_DIR"
+#define TRACE_TMP_DIR_VAR "TMPDIR"
+#define TRACE_DUMP_BUF_SZ 4096
+
+/* Kinds of events */
+enum trace_type {
+	TRACE_LINE_READ,    /* arg: length of the line */
+	TRACE_LEX_START,
+	TRACE_LEX_END,      /* arg: number of tokens */
+	TRACE_FORK,         /* pid: the child */
+	TRACE_EXEC,         /* pid: the process that runs the command */
+	TRACE_WAIT,         /* pid: the child reaped, arg: its exit status */
+	TRACE_BUILTIN_START,
+	TRACE_BUILTIN_END,  /* arg: exit status */
+};
+
+/* Struct to store a traced event. Records are written into a ring without
+ * locks: a writer claims a slot by bumping the head, fills it, then
+ * publishes it by storing its sequence number. A reader skips a record
+ * whose sequence number is not the expected one or changes under it. */
+struct trace_record {
+	uint64_t seq;       /* Index + 1 once written, 0 while being written */
+	uint64_t ts_ns;     /* CLOCK_MONOTONIC */
+	int64_t arg;
+	int32_t pid;
+	int32_t tid;
+	uint16_t type;
+	char name[TRACE_NAME_SZ];
+};
+
+/* Function Prototypes */
+void init_trace(void);
+void trace_event(enum trace_type type, pid_t pid, int64_t arg, const char *name);
+int trace_dump(int fd);
+void trace_clear(void);
+
+#endif
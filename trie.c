@@ -0,0 +1,332 @@
+#include "trie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Function to set up an empty trie
+ *
+ * Parameters:
+ * - t: trie to set up
+ * - line_text: gives the text of an indexed line by cmd id
+ *
+ * Returns: void
+ */
+void trie_init(struct trie *t, const char *(*line_text)(int id)) {
+	t->cap = TRIE_INIT_SZ;
+	t->nodes = calloc(t->cap, sizeof(struct trie_node));
+	t->size = 1;
+	t->free_list = 0;
+	t->line_text = line_text;
+	t->nodes[0].latest = t->nodes[0].prev = -1;
+}
+
+/**
+ * Function to get an unused node, reusing freed ones first
+ *
+ * Parameters:
+ * - t: trie to allocate from
+ * - label: text of the edge leading to the node
+ * - len: length of the label
+ * - depth: characters above the label
+ *
+ * Returns: index of the node, or 0 if memory cannot be allocated.
+ */
+static uint32_t new_node(struct trie *t, const char *label, size_t len, size_t depth) {
+	uint32_t n;
+
+	if (t->free_list != 0) {
+		n = t->free_list;
+		t->free_list = t->nodes[n].sibling;
+	} else {
+		if (t->size == t->cap) {
+			struct trie_node *nodes = realloc(t->nodes, sizeof(struct trie_node) * t->cap * 2);
+			if (nodes == NULL) {
+				perror("realloc");
+				return 0;
+			}
+			t->nodes = nodes;
+			t->cap *= 2;
+		}
+		n = t->size++;
+	}
+
+	t->nodes[n].label = label;
+	t->nodes[n].c = label[0];
+	t->nodes[n].label_len = len;
+	t->nodes[n].depth = depth;
+	t->nodes[n].child = 0;
+	t->nodes[n].sibling = 0;
+	t->nodes[n].count = 0;
+	t->nodes[n].latest = t->nodes[n].prev = -1;
+	return n;
+}
+
+/**
+ * Function to count a line under a node, keeping its two newest ids
+ *
+ * Parameters:
+ * - node: node the line passes through
+ * - id: cmd id of the line
+ *
+ * Returns: void
+ */
+static void count_line(struct trie_node *node, int id) {
+	node->count++;
+	if (node->latest < id) {
+		node->prev = node->latest;
+		node->latest = id;
+	} else if (node->prev < id) {
+		node->prev = id;
+	}
+}
+
+/**
+ * Function to find the child of a node whose label starts with a character
+ *
+ * Parameters:
+ * - t: trie to search
+ * - parent: node whose children to search
+ * - c: character to find
+ *
+ * Returns: index of the child, or 0 if there is none.
+ */
+static uint32_t find_child(struct trie *t, uint32_t parent, char c) {
+	uint32_t n = t->nodes[parent].child;
+	while (n != 0 && t->nodes[n].c != c) {
+		n = t->nodes[n].sibling;
+	}
+	return n;
+}
+
+/**
+ * Function to find the link that points to a child of a node
+ *
+ * Parameters:
+ * - t: trie to search
+ * - parent: node whose children to search
+ * - n: child to find
+ *
+ * Returns: the parent's child link or the sibling link holding n.
+ */
+static uint32_t *child_link(struct trie *t, uint32_t parent, uint32_t n) {
+	uint32_t *link = &t->nodes[parent].child;
+	while (*link != n) {
+		link = &t->nodes[*link].sibling;
+	}
+	return link;
+}
+
+/**
+ * Function to merge a node with its only child when no line ends at it, so
+ * removals leave no chains of single children behind
+ *
+ * Parameters:
+ * - t: trie to compact
+ * - n: node to merge into
+ *
+ * Returns: true if the child was merged, false if not.
+ */
+static bool merge_child(struct trie *t, uint32_t n) {
+	struct trie_node *node = &t->nodes[n];
+	uint32_t child = node->child;
+
+	if (child == 0 || t->nodes[child].sibling != 0 || t->nodes[child].count != node->count) {
+		return false;
+	}
+
+	/* The same lines pass through both, so either label continues in the
+	 * newest of them */
+	struct trie_node *below = &t->nodes[child];
+	node->label = t->line_text(below->latest) + node->depth;
+	node->label_len += below->label_len;
+	node->child = below->child;
+	below->sibling = t->free_list;
+	t->free_list = child;
+	return true;
+}
+
+/**
+ * Function to add a line to the trie. Every node on the path remembers the
+ * two newest ids below it. Lines of the history file may be indexed after
+ * newer ones, so an older id never replaces a newer one. The line must stay
+ * in place until it is removed, since labels point into it.
+ *
+ * Parameters:
+ * - t: trie to add to
+ * - line: line to add
+ * - len: length of the line
+ * - id: cmd id of the line
+ *
+ * Returns: void
+ */
+void trie_insert(struct trie *t, const char *line, size_t len, int id) {
+	uint32_t n = 0;
+	size_t pos = 0;
+
+	count_line(&t->nodes[0], id);
+
+	while (pos < len) {
+		uint32_t child = find_child(t, n, line[pos]);
+		if (child == 0) {
+			child = new_node(t, line + pos, len - pos, pos);
+			if (child == 0) {
+				return;
+			}
+			t->nodes[child].sibling = t->nodes[n].child;
+			t->nodes[n].child = child;
+			count_line(&t->nodes[child], id);
+			return;
+		}
+
+		/* Follow the label as far as the line matches it */
+		struct trie_node *node = &t->nodes[child];
+		uint32_t i = 1;
+		while (i < node->label_len && pos + i < len && node->label[i] == line[pos + i]) {
+			i++;
+		}
+
+		/* The line leaves the label part way, so split it. The upper part
+		 * keeps the lines of the whole label. */
+		if (i < node->label_len) {
+			uint32_t split = new_node(t, node->label, i, node->depth);
+			if (split == 0) {
+				return;
+			}
+			node = &t->nodes[child];
+			t->nodes[split].count = node->count;
+			t->nodes[split].latest = node->latest;
+			t->nodes[split].prev = node->prev;
+			t->nodes[split].child = child;
+			t->nodes[split].sibling = node->sibling;
+			*child_link(t, n, child) = split;
+			node->sibling = 0;
+			node->label += i;
+			node->label_len -= i;
+			node->c = node->label[0];
+			node->depth += i;
+			child = split;
+		}
+
+		count_line(&t->nodes[child], id);
+		n = child;
+		pos += i;
+	}
+}
+
+/**
+ * Function to remove the oldest line from the trie. Nodes that no other line
+ * passes through are freed, and labels that point into the line are moved to
+ * a line that stays. Because the removed line is always the oldest, the two
+ * newest ids of every node that survives stay the same, unless it is left
+ * with one line.
+ *
+ * Parameters:
+ * - t: trie to remove from
+ * - line: line to remove
+ * - len: length of the line
+ *
+ * Returns: void
+ */
+void trie_remove(struct trie *t, const char *line, size_t len) {
+	uint32_t n = 0;
+	size_t pos = 0;
+
+	t->nodes[0].count--;
+	if (t->nodes[0].count == 0) {
+		t->nodes[0].latest = -1;
+	}
+	if (t->nodes[0].count <= 1) {
+		t->nodes[0].prev = -1;
+	}
+
+	while (pos < len) {
+		uint32_t parent = n;
+		n = find_child(t, parent, line[pos]);
+		if (n == 0) {
+			break;
+		}
+
+		struct trie_node *node = &t->nodes[n];
+		if (--node->count == 0) {
+			/* Everything below it belongs to this line alone, free it all */
+			*child_link(t, parent, n) = node->sibling;
+			while (n != 0) {
+				uint32_t child = t->nodes[n].child;
+				t->nodes[n].sibling = t->free_list;
+				t->free_list = n;
+				n = child;
+			}
+			break;
+		}
+
+		if (node->count == 1) {
+			node->prev = -1;
+		}
+		if (node->label >= line && node->label < line + len) {
+			node->label = t->line_text(node->latest) + node->depth;
+		}
+		pos += node->label_len;
+	}
+
+	/* Nodes on the path may be left with one child and no line of their own */
+	n = 0;
+	pos = 0;
+	while (pos < len) {
+		n = find_child(t, n, line[pos]);
+		if (n == 0) {
+			return;
+		}
+		while (merge_child(t, n)) { }
+		pos += t->nodes[n].label_len;
+	}
+}
+
+/**
+ * Function to find the newest line starting with a prefix. Takes time
+ * proportional to the length of the prefix. Only the two newest ids of a
+ * node are kept, so before may skip at most the newest line.
+ *
+ * Parameters:
+ * - t: trie to search
+ * - prefix: prefix to look for
+ * - len: length of the prefix
+ * - before: newest cmd id to consider
+ *
+ * Returns: cmd id of the newest line with that prefix, or -1 if there is
+ * none.
+ */
+int trie_latest(struct trie *t, const char *prefix, size_t len, int before) {
+	uint32_t n = 0;
+	size_t pos = 0;
+
+	while (pos < len) {
+		n = find_child(t, n, prefix[pos]);
+		if (n == 0) {
+			return -1;
+		}
+
+		size_t m = len - pos < t->nodes[n].label_len ? len - pos : t->nodes[n].label_len;
+		if (memcmp(t->nodes[n].label, prefix + pos, m) != 0) {
+			return -1;
+		}
+		pos += m;
+	}
+	return t->nodes[n].latest <= before ? t->nodes[n].latest : t->nodes[n].prev;
+}
+
+/**
+ * Function to free all memory used by a trie. The lines themselves belong to
+ * the caller.
+ *
+ * Parameters:
+ * - t: trie to free
+ *
+ * Returns: void
+ */
+void trie_free(struct trie *t) {
+	free(t->nodes);
+	t->nodes = NULL;
+	t->size = t->cap = t->free_list = 0;
+}
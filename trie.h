@@ -0,0 +1,46 @@
+#ifndef _TRIE_H_
+#define _TRIE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Preprocessor Directives */
+#define TRIE_INIT_SZ 256
+
+/* Trie node, linked to its children and siblings by index into the pool.
+ * Chains of single children are merged into one node, whose label is the
+ * text of the edge leading to it. The label is not copied: it points into a
+ * line below the node, at offset depth; its first character is also kept in
+ * the node, so finding a child does not read the lines. Every node keeps the
+ * two newest ids below it, so a lookup can skip the line being run. */
+struct trie_node {
+	const char *label;
+	uint32_t label_len;
+	uint32_t depth;
+	uint32_t child;
+	uint32_t sibling;
+	uint32_t count;
+	int latest;
+	int prev;
+	char c;
+};
+
+/* Prefix tree over history lines; node 0 is the root. line_text gives the
+ * text of a line by cmd id, so labels can be moved off a removed line. */
+struct trie {
+	struct trie_node *nodes;
+	uint32_t size;
+	uint32_t cap;
+	uint32_t free_list;
+	const char *(*line_text)(int id);
+};
+
+/* Function Prototypes */
+void trie_init(struct trie *t, const char *(*line_text)(int id));
+void trie_insert(struct trie *t, const char *line, size_t len, int id);
+void trie_remove(struct trie *t, const char *line, size_t len);
+int trie_latest(struct trie *t, const char *prefix, size_t len, int before);
+void trie_free(struct trie *t);
+
+#endif
@@ -0,0 +1,631 @@
+#include "utilities.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Struct to walk the arguments of test */
+struct test_args {
+	char **argv;
+	int argc;
+	int pos;
+	bool error;
+};
+
+/**
+ * Function to print a string, interpreting backslash escapes the way
+ * "echo -e" and "printf %b" do
+ *
+ * Parameters:
+ * - out: stream to print to
+ * - str: string to print
+ * - octal_zero: true if octal escapes start with \0 (echo), false if they
+ *   are \nnn (printf format strings)
+ *
+ * Returns: true if a \c escape asked to stop all output, false if not.
+ */
+static bool print_escaped(FILE *out, const char *str, bool octal_zero) {
+	while (*str != '\0') {
+		if (*str != '\\' || str[1] == '\0') {
+			putc(*str++, out);
+			continue;
+		}
+
+		str++;
+		int c = *str++, i;
+		switch (c) {
+		case 'a': putc('\a', out); break;
+		case 'b': putc('\b', out); break;
+		case 'c': return true;
+		case 'e': putc('\033', out); break;
+		case 'f': putc('\f', out); break;
+		case 'n': putc('\n', out); break;
+		case 'r': putc('\r', out); break;
+		case 't': putc('\t', out); break;
+		case 'v': putc('\v', out); break;
+		case '\\': putc('\\', out); break;
+		case 'x':
+			/* Up to two hex digits */
+			for (c = 0, i = 0; i < 2 && isxdigit((unsigned char)*str); i++, str++) {
+				c = c * 16 + (isdigit((unsigned char)*str) ? *str - '0' : (tolower((unsigned char)*str) - 'a' + 10));
+			}
+			if (i == 0) {
+				fputs("\\x", out);
+			} else {
+				putc(c, out);
+			}
+			break;
+		default:
+			/* Up to three octal digits, after a 0 for echo */
+			if (c >= '0' && c <= '7' && (c == '0' || !octal_zero)) {
+				int value = octal_zero ? 0 : c - '0';
+				for (i = 0; i < 3 - !octal_zero && *str >= '0' && *str <= '7'; i++, str++) {
+					value = value * 8 + (*str - '0');
+				}
+				putc(value & 0xff, out);
+			} else {
+				putc('\\', out);
+				putc(c, out);
+			}
+			break;
+		}
+	}
+	return false;
+}
+
+/**
+ * Function to print arguments separated by spaces ("echo"). Like the
+ * coreutils echo, -n drops the newline and -e turns on backslash escapes.
+ *
+ * Parameters:
+ * - tokens: "echo" and its arguments
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0
+ */
+int builtin_echo(char *tokens[], char *line, FILE *out) {
+	bool newline = true, escapes = false;
+	int i, first;
+
+	/* Leading arguments made only of n, e and E are options */
+	for (i = 1; tokens[i] != NULL && tokens[i][0] == '-' && tokens[i][1] != '\0'
+			&& tokens[i][1 + strspn(tokens[i] + 1, "neE")] == '\0'; i++) {
+		const char *opt;
+		for (opt = tokens[i] + 1; *opt != '\0'; opt++) {
+			if (*opt == 'n') {
+				newline = false;
+			} else {
+				escapes = *opt == 'e';
+			}
+		}
+	}
+
+	for (first = i; tokens[i] != NULL; i++) {
+		if (i > first) {
+			putc(' ', out);
+		}
+		if (!escapes) {
+			fputs(tokens[i], out);
+		} else if (print_escaped(out, tokens[i], true)) {
+			return 0;
+		}
+	}
+	if (newline) {
+		putc('\n', out);
+	}
+	return 0;
+}
+
+/**
+ * Function to convert a printf argument to a number. Like printf(1), an
+ * argument starting with a quote stands for the value of the next character.
+ *
+ * Parameters:
+ * - arg: argument to convert, or NULL if arguments ran out
+ * - is_signed: true to parse a signed number
+ * - ret: set to 1 if the argument is not a valid number
+ *
+ * Returns: value of the argument.
+ */
+static long long printf_number(const char *arg, bool is_signed, int *ret) {
+	char *end;
+	long long value;
+
+	if (arg == NULL) {
+		return 0;
+	}
+	if (arg[0] == '\'' || arg[0] == '"') {
+		return (unsigned char)arg[1];
+	}
+
+	errno = 0;
+	value = is_signed ? strtoll(arg, &end, 0) : (long long)strtoull(arg, &end, 0);
+	if (end == arg || *end != '\0' || errno != 0) {
+		fprintf(stderr, "crash: printf: %s: invalid number\n", arg);
+		*ret = 1;
+	}
+	return value;
+}
+
+/**
+ * Function to print the format string once, taking arguments as the
+ * conversions ask for them
+ *
+ * Parameters:
+ * - out: stream to print to
+ * - format: format string
+ * - args: arguments left; advanced past the ones used
+ * - ret: set to 1 if an argument is invalid
+ *
+ * Returns: true if a \c escape asked to stop all output, false if not.
+ */
+static bool printf_once(FILE *out, const char *format, char ***args, int *ret) {
+	const char *p = format;
+
+	while (*p != '\0') {
+		/* Escapes in the format itself */
+		if (*p == '\\') {
+			const char *end = p + 1 + (p[1] != '\0');
+			if (p[1] >= '0' && p[1] <= '7') {
+				while (end < p + 4 && *end >= '0' && *end <= '7') {
+					end++;
+				}
+			} else if (p[1] == 'x') {
+				while (end < p + 4 && isxdigit((unsigned char)*end)) {
+					end++;
+				}
+			}
+			char escape[8];
+			snprintf(escape, sizeof(escape), "%.*s", (int)(end - p), p);
+			if (print_escaped(out, escape, false)) {
+				return true;
+			}
+			p = end;
+			continue;
+		}
+		if (*p != '%') {
+			putc(*p++, out);
+			continue;
+		}
+		if (p[1] == '%') {
+			putc('%', out);
+			p += 2;
+			continue;
+		}
+
+		/* Copy the flags, width and precision of the conversion */
+		char spec[32];
+		size_t len = strspn(p + 1, "-+ #0");
+		len += strspn(p + 1 + len, "0123456789*");
+		if (p[1 + len] == '.') {
+			len++;
+			len += strspn(p + 1 + len, "0123456789*");
+		}
+		char conv = p[1 + len];
+		/* spec gets '%', the flags, up to "llx" and the NUL */
+		if (conv == '\0' || len + 5 > sizeof(spec) || memchr(p + 1, '*', len) != NULL) {
+			/* Star widths and malformed conversions are printed as they are */
+			fputs(p, out);
+			return false;
+		}
+		memcpy(spec, p, len + 1);
+		spec[len + 1] = '\0';
+		p += len + 2;
+
+		char *arg = **args;
+		if (arg != NULL) {
+			(*args)++;
+		}
+
+		switch (conv) {
+		case 'd':
+		case 'i':
+			strcat(spec, "lld");
+			fprintf(out, spec, printf_number(arg, true, ret));
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			len = strlen(spec);
+			spec[len] = 'l';
+			spec[len + 1] = 'l';
+			spec[len + 2] = conv;
+			spec[len + 3] = '\0';
+			fprintf(out, spec, (unsigned long long)printf_number(arg, false, ret));
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			len = strlen(spec);
+			spec[len] = conv;
+			spec[len + 1] = '\0';
+			fprintf(out, spec, arg == NULL ? 0.0 : strtod(arg, NULL));
+			break;
+		case 'c':
+			strcat(spec, "c");
+			if (arg != NULL) {
+				fprintf(out, spec, arg[0]);
+			}
+			break;
+		case 's':
+			strcat(spec, "s");
+			fprintf(out, spec, arg == NULL ? "" : arg);
+			break;
+		case 'b':
+			if (arg != NULL && print_escaped(out, arg, true)) {
+				return true;
+			}
+			break;
+		default:
+			fprintf(stderr, "crash: printf: %%%c: invalid directive\n", conv);
+			*ret = 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Function to print formatted output ("printf"). The format is reused until
+ * every argument has been consumed.
+ *
+ * Parameters:
+ * - tokens: "printf", the format and its arguments
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0 on success, 1 if an argument is invalid, 2 without a format.
+ */
+int builtin_printf(char *tokens[], char *line, FILE *out) {
+	int ret = 0;
+
+	if (tokens[1] == NULL) {
+		fprintf(stderr, "crash: printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+
+	char **args = tokens + 2;
+	while (true) {
+		char **before = args;
+		if (printf_once(out, tokens[1], &args, &ret) || *args == NULL || args == before) {
+			break;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Function to do nothing, successfully ("true")
+ *
+ * Parameters:
+ * - tokens: unused
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: 0
+ */
+int builtin_true(char *tokens[], char *line, FILE *out) {
+	return 0;
+}
+
+/**
+ * Function to do nothing, unsuccessfully ("false")
+ *
+ * Parameters:
+ * - tokens: unused
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: 1
+ */
+int builtin_false(char *tokens[], char *line, FILE *out) {
+	return 1;
+}
+
+/**
+ * Function to print the working directory ("pwd")
+ *
+ * Parameters:
+ * - tokens: unused
+ * - line: unused
+ * - out: stream to print to
+ *
+ * Returns: 0 on success, 1 if it cannot be found.
+ */
+int builtin_pwd(char *tokens[], char *line, FILE *out) {
+	char dir[PATH_MAX];
+
+	if (getcwd(dir, sizeof(dir)) == NULL) {
+		perror("pwd");
+		return 1;
+	}
+	fprintf(out, "%s\n", dir);
+	return 0;
+}
+
+/**
+ * Function to parse an integer operand of test
+ *
+ * Parameters:
+ * - t: test arguments, for reporting errors
+ * - arg: operand to parse
+ *
+ * Returns: value of the operand.
+ */
+static long long test_number(struct test_args *t, const char *arg) {
+	char *end;
+	errno = 0;
+	long long value = strtoll(arg, &end, 10);
+	if (end == arg || *end != '\0' || errno != 0) {
+		fprintf(stderr, "crash: test: %s: integer expression expected\n", arg);
+		t->error = true;
+	}
+	return value;
+}
+
+/**
+ * Function to tell if an argument is a binary operator of test
+ *
+ * Parameters:
+ * - op: argument to check
+ *
+ * Returns: true if it is a binary operator, false if not.
+ */
+static bool test_is_binary(const char *op) {
+	static const char *ops[] = { "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+	int i;
+	for (i = 0; ops[i] != NULL; i++) {
+		if (strcmp(op, ops[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Function to evaluate a binary operator of test
+ *
+ * Parameters:
+ * - t: test arguments, for reporting errors
+ * - a: left operand
+ * - op: operator
+ * - b: right operand
+ *
+ * Returns: result of the comparison.
+ */
+static bool test_binary(struct test_args *t, const char *a, const char *op, const char *b) {
+	struct stat sa, sb;
+
+	if (op[0] != '-') {
+		return (strcmp(a, b) == 0) == (op[0] != '!');
+	}
+	if (op[1] == 'n' && op[2] == 't') {
+		return stat(a, &sa) == 0 && (stat(b, &sb) != 0 || sa.st_mtime > sb.st_mtime);
+	}
+	if (op[1] == 'o' && op[2] == 't') {
+		return stat(b, &sb) == 0 && (stat(a, &sa) != 0 || sa.st_mtime < sb.st_mtime);
+	}
+	if (op[1] == 'e' && op[2] == 'f') {
+		return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+	}
+
+	long long x = test_number(t, a), y = test_number(t, b);
+	switch (op[1] << 8 | op[2]) {
+	case 'e' << 8 | 'q': return x == y;
+	case 'n' << 8 | 'e': return x != y;
+	case 'l' << 8 | 't': return x < y;
+	case 'l' << 8 | 'e': return x <= y;
+	case 'g' << 8 | 't': return x > y;
+	default: return x >= y;
+	}
+}
+
+/**
+ * Function to evaluate a unary operator of test
+ *
+ * Parameters:
+ * - op: operator character, like 'f' for -f
+ * - arg: operand
+ * - result: set to the result
+ *
+ * Returns: true if op is a unary operator, false if not.
+ */
+static bool test_unary(char op, const char *arg, bool *result) {
+	struct stat st;
+	bool exists = op != 'L' && op != 'h' ? stat(arg, &st) == 0 : lstat(arg, &st) == 0;
+
+	switch (op) {
+	case 'n': *result = arg[0] != '\0'; break;
+	case 'z': *result = arg[0] == '\0'; break;
+	case 'e': *result = exists; break;
+	case 'f': *result = exists && S_ISREG(st.st_mode); break;
+	case 'd': *result = exists && S_ISDIR(st.st_mode); break;
+	case 'b': *result = exists && S_ISBLK(st.st_mode); break;
+	case 'c': *result = exists && S_ISCHR(st.st_mode); break;
+	case 'p': *result = exists && S_ISFIFO(st.st_mode); break;
+	case 'S': *result = exists && S_ISSOCK(st.st_mode); break;
+	case 'L':
+	case 'h': *result = exists && S_ISLNK(st.st_mode); break;
+	case 's': *result = exists && st.st_size > 0; break;
+	case 'r': *result = access(arg, R_OK) == 0; break;
+	case 'w': *result = access(arg, W_OK) == 0; break;
+	case 'x': *result = access(arg, X_OK) == 0; break;
+	case 't': *result = isatty(atoi(arg)); break;
+	default: return false;
+	}
+	return true;
+}
+
+static bool test_or(struct test_args *t);
+
+/**
+ * Function to evaluate a primary of test: a parenthesized expression, a
+ * unary or binary operator with its operands, or a single string
+ *
+ * Parameters:
+ * - t: test arguments
+ *
+ * Returns: result of the primary.
+ */
+static bool test_primary(struct test_args *t) {
+	char **argv = t->argv + t->pos;
+	int left = t->argc - t->pos;
+	bool result;
+
+	if (left <= 0) {
+		fprintf(stderr, "crash: test: argument expected\n");
+		t->error = true;
+		return false;
+	}
+
+	/* A binary operator takes precedence, so "test -n = -n" compares */
+	if (left >= 3 && test_is_binary(argv[1])) {
+		t->pos += 3;
+		return test_binary(t, argv[0], argv[1], argv[2]);
+	}
+	if (strcmp(argv[0], "(") == 0 && left >= 2) {
+		t->pos++;
+		result = test_or(t);
+		if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+			fprintf(stderr, "crash: test: ')' expected\n");
+			t->error = true;
+			return false;
+		}
+		t->pos++;
+		return result;
+	}
+	if (left >= 2 && argv[0][0] == '-' && argv[0][1] != '\0' && argv[0][2] == '\0'
+			&& test_unary(argv[0][1], argv[1], &result)) {
+		t->pos += 2;
+		return result;
+	}
+
+	/* A lone string is true if it is not empty */
+	t->pos++;
+	return argv[0][0] != '\0';
+}
+
+/**
+ * Function to evaluate "!" of test
+ *
+ * Parameters:
+ * - t: test arguments
+ *
+ * Returns: result of the expression.
+ */
+static bool test_not(struct test_args *t) {
+	if (t->argc - t->pos >= 2 && strcmp(t->argv[t->pos], "!") == 0) {
+		t->pos++;
+		return !test_not(t);
+	}
+	return test_primary(t);
+}
+
+/**
+ * Function to evaluate "-a" of test, which binds tighter than "-o"
+ *
+ * Parameters:
+ * - t: test arguments
+ *
+ * Returns: result of the expression.
+ */
+static bool test_and(struct test_args *t) {
+	bool result = test_not(t);
+	while (t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+		t->pos++;
+		result = test_not(t) && result;
+	}
+	return result;
+}
+
+/**
+ * Function to evaluate "-o" of test
+ *
+ * Parameters:
+ * - t: test arguments
+ *
+ * Returns: result of the expression.
+ */
+static bool test_or(struct test_args *t) {
+	bool result = test_and(t);
+	while (t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+		t->pos++;
+		result = test_and(t) || result;
+	}
+	return result;
+}
+
+/**
+ * Function to evaluate a test expression
+ *
+ * Parameters:
+ * - argv: arguments of the expression
+ * - argc: number of arguments
+ *
+ * Returns: 0 if the expression is true, 1 if false, 2 on error.
+ */
+static int run_test(char **argv, int argc) {
+	struct test_args t = { argv, argc, 0, false };
+
+	/* No expression is false */
+	if (argc == 0) {
+		return 1;
+	}
+
+	bool result = test_or(&t);
+	if (!t.error && t.pos < argc) {
+		fprintf(stderr, "crash: test: %s: unexpected argument\n", argv[t.pos]);
+		t.error = true;
+	}
+	return t.error ? 2 : !result;
+}
+
+/**
+ * Function to evaluate a conditional expression ("test")
+ *
+ * Parameters:
+ * - tokens: "test" and the expression
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: 0 if the expression is true, 1 if false, 2 on error.
+ */
+int builtin_test(char *tokens[], char *line, FILE *out) {
+	int argc = 0;
+	while (tokens[argc + 1] != NULL) {
+		argc++;
+	}
+	return run_test(tokens + 1, argc);
+}
+
+/**
+ * Function to evaluate a conditional expression ("[ ... ]")
+ *
+ * Parameters:
+ * - tokens: "[", the expression and "]"
+ * - line: unused
+ * - out: unused
+ *
+ * Returns: 0 if the expression is true, 1 if false, 2 on error.
+ */
+int builtin_bracket(char *tokens[], char *line, FILE *out) {
+	int argc = 0;
+	while (tokens[argc + 1] != NULL) {
+		argc++;
+	}
+	if (argc == 0 || strcmp(tokens[argc], "]") != 0) {
+		fprintf(stderr, "crash: [: missing ']'\n");
+		return 2;
+	}
+	return run_test(tokens + 1, argc - 1);
+}
@@ -0,0 +1,17 @@
+#ifndef _UTILITIES_H_
+#define _UTILITIES_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Builtins that stand in for common external utilities. They run in the
+ * shell itself; they share the builtin_fn signature from builtins.h. */
+int builtin_echo(char *tokens[], char *line, FILE *out);
+int builtin_printf(char *tokens[], char *line, FILE *out);
+int builtin_true(char *tokens[], char *line, FILE *out);
+int builtin_false(char *tokens[], char *line, FILE *out);
+int builtin_pwd(char *tokens[], char *line, FILE *out);
+int builtin_test(char *tokens[], char *line, FILE *out);
+int builtin_bracket(char *tokens[], char *line, FILE *out);
+
+#endif